@@ -0,0 +1,169 @@
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <functional>
+#include <zmqpp/zmqpp.hpp>
+
+
+#include "lib/logging.hpp"
+
+
+// usage: broker <clients end point> <subscribers end point> <publishers end point>
+//               <internal subscribers end point> <internal publishers end point> <server end point>...
+//
+// e.g. two servers on one host, both started in same directory, so they share database files:
+//     broker tcp://127.0.0.1:4507 tcp://127.0.0.1:4508 ipc:///tmp/cp-bus ipc:///tmp/cp-internal-sub
+//            ipc:///tmp/cp-internal-pub ipc:///tmp/cp-server-0 ipc:///tmp/cp-server-1
+//     export CP_BROKER_PUBLISH_END_POINT=ipc:///tmp/cp-bus
+//     export CP_BROKER_INTERNAL_SUBSCRIBE_END_POINT=ipc:///tmp/cp-internal-sub
+//     export CP_BROKER_INTERNAL_PUBLISH_END_POINT=ipc:///tmp/cp-internal-pub
+//     CP_ROUTER_END_POINT=ipc:///tmp/cp-server-0 CP_PULL_END_POINT=tcp://127.0.0.1:5506 server
+//     CP_ROUTER_END_POINT=ipc:///tmp/cp-server-1 CP_PULL_END_POINT=tcp://127.0.0.1:6506 server
+//
+// router clients connect to broker like to server, requests of client always go to server chosen by its identity,
+// so its session stays on one process; legacy push-connect clients connect to pull end point of some server.
+// Notifications published by every server are forwarded to every subscriber of client bus, cache invalidations
+// go over internal bus, whose end points must be reachable by servers only, e.g. ipc or loopback
+
+
+// Not thread-safe, runs on thread that calls run
+class Broker {
+    zmqpp::context context{};
+
+    zmqpp::socket clientsSocket{context, zmqpp::socket_type::router};
+    // one per server, so request can be sent to chosen one
+    std::vector<std::unique_ptr<zmqpp::socket>> serverSockets{};
+
+    // client bus, clients subscribe here, servers publish to publishersSocket
+    zmqpp::socket subscribersSocket{context, zmqpp::socket_type::xpublish};
+    zmqpp::socket publishersSocket{context, zmqpp::socket_type::xsubscribe};
+
+    // internal bus of servers, same as client bus
+    zmqpp::socket internalSubscribersSocket{context, zmqpp::socket_type::xpublish};
+    zmqpp::socket internalPublishersSocket{context, zmqpp::socket_type::xsubscribe};
+
+    // request goes to next server when chosen one isn't connected, client restores session there with Resume
+    auto forwardRequest(zmqpp::message &request) -> void;
+
+    // forwards messages of bus downstream to subscribers and subscriptions upstream, so servers filter what they publish
+    static auto forwardBus(zmqpp::poller &poller, zmqpp::socket &subscribers, zmqpp::socket &publishers) -> void;
+
+public:
+    Broker(
+            const std::string &clientsEndPoint,
+            const std::string &subscribersEndPoint,
+            const std::string &publishersEndPoint,
+            const std::string &internalSubscribersEndPoint,
+            const std::string &internalPublishersEndPoint,
+            const std::vector<std::string> &serverEndPoints
+    );
+
+    auto run() -> void;
+};
+
+
+Broker::Broker(
+        const std::string &clientsEndPoint,
+        const std::string &subscribersEndPoint,
+        const std::string &publishersEndPoint,
+        const std::string &internalSubscribersEndPoint,
+        const std::string &internalPublishersEndPoint,
+        const std::vector<std::string> &serverEndPoints
+) {
+    for (const auto &serverEndPoint: serverEndPoints) {
+        auto socket = std::make_unique<zmqpp::socket>(context, zmqpp::socket_type::dealer);
+        // requests aren't queued for server that isn't connected
+        socket->set(zmqpp::socket_option::immediate, 1);
+        socket->connect(serverEndPoint);
+        serverSockets.push_back(std::move(socket));
+    }
+
+    clientsSocket.bind(clientsEndPoint);
+    subscribersSocket.bind(subscribersEndPoint);
+    publishersSocket.bind(publishersEndPoint);
+    internalSubscribersSocket.bind(internalSubscribersEndPoint);
+    internalPublishersSocket.bind(internalPublishersEndPoint);
+}
+
+
+auto Broker::forwardRequest(zmqpp::message &request) -> void {
+    // first frame is client identity assigned by router socket
+    const auto chosen = std::hash<std::string>{}(request.get(0)) % serverSockets.size();
+    for (size_t i = 0; i < serverSockets.size(); i++) {
+        if (serverSockets[(chosen + i) % serverSockets.size()]->send(request, true)) {
+            return;
+        }
+    }
+    logWarning("no server is connected, request is dropped");
+}
+
+
+auto Broker::forwardBus(zmqpp::poller &poller, zmqpp::socket &subscribers, zmqpp::socket &publishers) -> void {
+    if (poller.has_input(publishers)) {
+        zmqpp::message notification;
+        publishers.receive(notification);
+        subscribers.send(notification);
+    }
+
+    if (poller.has_input(subscribers)) {
+        zmqpp::message subscription;
+        subscribers.receive(subscription);
+        publishers.send(subscription);
+    }
+}
+
+
+auto Broker::run() -> void {
+    zmqpp::poller poller;
+    poller.add(clientsSocket);
+    poller.add(subscribersSocket);
+    poller.add(publishersSocket);
+    poller.add(internalSubscribersSocket);
+    poller.add(internalPublishersSocket);
+    for (auto &serverSocket: serverSockets) {
+        poller.add(*serverSocket);
+    }
+
+    logInfo("broker started, forwarding to ", serverSockets.size(), " servers");
+    while (poller.poll()) {
+        if (poller.has_input(clientsSocket)) {
+            zmqpp::message request;
+            clientsSocket.receive(request);
+            forwardRequest(request);
+        }
+
+        for (auto &serverSocket: serverSockets) {
+            if (poller.has_input(*serverSocket)) {
+                zmqpp::message response;
+                serverSocket->receive(response);
+                clientsSocket.send(response);
+            }
+        }
+
+        forwardBus(poller, subscribersSocket, publishersSocket);
+        forwardBus(poller, internalSubscribersSocket, internalPublishersSocket);
+    }
+}
+
+
+auto main(int argc, char *argv[]) -> int {
+    if (argc < 7) {
+        logError("usage: broker <clients end point> <subscribers end point> <publishers end point> "
+                 "<internal subscribers end point> <internal publishers end point> <server end point>...");
+        return 1;
+    }
+
+    try {
+        if (const auto *logLevel = std::getenv("CP_LOG_LEVEL")) {
+            Logger::get().setLevel(parseLogLevel(logLevel));
+        }
+
+        Broker broker(argv[1], argv[2], argv[3], argv[4], argv[5], std::vector<std::string>(argv + 6, argv + argc));
+        broker.run();
+    } catch (zmqpp::exception &exception) {
+        logError("broker caught zmq exception: ", exception.what());
+        return 1;
+    }
+    return 0;
+}
@@ -1,16 +1,20 @@
 #include <mutex>
 #include <chrono>
 #include <string>
+#include <memory>
+#include <optional>
 #include <thread>
-#include <random>
+#include <stop_token>
 #include <sstream>
 #include <utility>
 #include <iostream>
+#include <algorithm>
 #include <zmqpp/zmqpp.hpp>
 
 
 #include "lib/messaging.hpp"
-#include "lib/networking.hpp"
+#include "lib/messageCache.hpp"
+#include "lib/clientTransport.hpp"
 
 
 #define RESET   "\033[0m"
@@ -19,78 +23,195 @@
 
 std::string username;
 
+// returned on authentication, restores session on reconnect without password
+std::string sessionToken;
+// main and notifier threads both restore session
+std::mutex sessionTokenMutex;
+
 
 std::vector<std::string> chats;
-std::mutex mutex;
+std::mutex chatsMutex;
+
+// opened after authentication, as it's file per user
+std::unique_ptr<MessageCache> messageCache;
 
 
-constexpr int32_t sendTimeout = 3 * 1000;
 constexpr int32_t receiveTimeout = 3 * 1000;
+// messages server publishes faster than they are consumed are dropped above it
+constexpr int32_t notificationsCapacity = 10000;
+constexpr int32_t pageLimit = 50;
+constexpr int32_t syncPageLimit = 1000;
 
 
-auto updater(zmqpp::socket &clientSocket) -> void {
-    static time_t lastChatsUpdateTime{0};
+const std::string serverEndPoint("tcp://192.168.1.2:4507");
+const std::string notificationsEndPoint("tcp://192.168.1.2:4508");
 
-    try {
-        while (true) {
-            auto message = Message(MessageType::UpdateChats, MessageData(lastChatsUpdateTime, username, ""));
-            mutex.lock();
-            sendMessage(clientSocket, message);
-            receiveMessage(clientSocket, message);
-            mutex.unlock();
-
-            for (const auto &chat: message.data.vector) {
-                chats.push_back(chat);
-            }
 
-            if (message.data.vector.empty()) {
-                lastChatsUpdateTime == 0 ? lastChatsUpdateTime = 0 : lastChatsUpdateTime = message.data.time;
-            } else {
-                lastChatsUpdateTime = message.data.time;
-            }
+// subscribes to new messages of chat, socket must be owned by calling thread
+auto addChat(zmqpp::socket &subscribeSocket, const std::string &chat) -> void {
+    std::lock_guard lockGuard(chatsMutex);
+    if (std::find(chats.begin(), chats.end(), chat) == chats.end()) {
+        chats.push_back(chat);
+        messageCache->insertChat(chat);
+        subscribeSocket.subscribe(chatTopic(chat));
+    }
+}
+
+
+// restores session with token, server loses sessions on restart
+auto resume(ClientTransport &transport) -> void {
+    std::lock_guard lockGuard(sessionTokenMutex);
+    auto resumeRequest = Message(MessageType::Resume, MessageData(sessionToken));
+    resumeRequest.compression = Compression::Zstd;
+
+    const auto response = transport.request(resumeRequest);
+    if (response.authenticationStatus != AuthenticationStatus::Success) {
+        throw std::runtime_error("session expired, sign in again");
+    }
+    sessionToken = response.data.buffer;
+}
+
+
+auto isReadRequest(const Message &message) -> bool {
+    return message.type == MessageType::UpdateChats || message.type == MessageType::GetMessagesPage ||
+           message.type == MessageType::GetAllMessagesFromChat;
+}
 
-            std::this_thread::sleep_for(std::chrono::seconds(2));
+
+// sends request and receives response into message, restores lost session and retries;
+// after timeout only reads are retried, as lost response doesn't tell whether write was applied
+auto request(ClientTransport &transport, Message &message) -> void {
+    const auto requestMessage = message;
+    try {
+        message = transport.request(requestMessage);
+        if (message.type != MessageType::ClientError ||
+            message.authenticationStatus != AuthenticationStatus::NotExists) {
+            return;
         }
-    } catch (...) {}
+        // session is unknown to server, so request wasn't applied
+        resume(transport);
+        message = transport.request(requestMessage);
+        return;
+    } catch (zmqpp::exception &) {
+        throw;
+    } catch (std::runtime_error &) {
+        resume(transport);
+    }
 
-    std::cout << "updater stopped" << std::endl;
+    if (isReadRequest(requestMessage)) {
+        message = transport.request(requestMessage);
+    } else {
+        message = Message(MessageType::ClientError, MessageData("Request timed out, it may not be applied"));
+    }
 }
 
 
-auto connectToServer(zmqpp::socket &serverSocket, zmqpp::socket &clientSocket) -> void {
+// all chats are fetched, as invite with shared history gives chat older time than last fetch; known ones are skipped
+auto fetchChats(ClientTransport &transport, zmqpp::socket &subscribeSocket) -> void {
+    auto message = Message(MessageType::UpdateChats, MessageData(0, username, ""));
+    request(transport, message);
+
+    for (const auto &chat: message.data.vector) {
+        addChat(subscribeSocket, chat);
+    }
+}
 
-    const std::string serverEndPoint("tcp://192.168.1.2:4506");
-    std::string clientEndPoint("tcp://" + getIP() + ":");
 
+// shows cached chats at once, then fetches chats user had before subscribing, later ones are announced by server
+auto loadChats(ClientTransport &transport, zmqpp::socket &subscribeSocket) -> void {
+    for (const auto &chat: messageCache->getChats()) {
+        addChat(subscribeSocket, chat);
+    }
+    fetchChats(transport, subscribeSocket);
+}
 
-    clientSocket.set(zmqpp::socket_option::send_timeout, sendTimeout);
-    clientSocket.set(zmqpp::socket_option::receive_timeout, receiveTimeout);
 
-    serverSocket.set(zmqpp::socket_option::send_timeout, sendTimeout);
-    serverSocket.set(zmqpp::socket_option::receive_timeout, receiveTimeout);
+// fetches page older than cursor, 0 for newest page, into cache and moves its oldest cursor to reply's cursor,
+// which is 0 once first message of chat is reached, returns error response if fetch fails
+auto fetchOlderMessages(
+        ClientTransport &transport,
+        const std::string &chatName,
+        int64_t cursor
+) -> std::optional<Message> {
+    MessageData msgData;
+    msgData.name = chatName;
+    msgData.cursor = cursor;
+    msgData.flag = false;
+    msgData.limit = pageLimit;
+    auto message = Message(MessageType::GetMessagesPage, msgData);
+
+    request(transport, message);
+    if (message.type == MessageType::ClientError || message.type == MessageType::ServerError) {
+        return message;
+    }
 
-    serverSocket.connect(serverEndPoint);
+    messageCache->insertOlderMessages(chatName, message.data.chatMessages, message.data.cursor);
+    return std::nullopt;
+}
 
-    // if testing on same machine with server
-    for (int i = 0; i < 5; i++) {
-        try {
-            std::random_device randomDevice;
-            std::mt19937 randomEngine(randomDevice());
-            std::uniform_int_distribution distribution(4000, 9999);
 
-            uint32_t port = distribution(randomEngine);
-            clientSocket.bind(clientEndPoint + std::to_string(port));
-            clientEndPoint += std::to_string(port);
-            break;
-        } catch (zmqpp::exception&) {
-            if (i == 4) {
-                std::cerr << "can't find appropriate port" << std::endl;
-                exit(1);
-            }
-            continue;
+// seeds empty cache with newest page, so whole history isn't fetched on first open,
+// then fetches messages newer than newest cached one page by page, returns error response if fetch fails
+auto syncMessages(ClientTransport &transport, const std::string &chatName) -> std::optional<Message> {
+    if (messageCache->getLastMessageId(chatName) == 0) {
+        if (auto error = fetchOlderMessages(transport, chatName, 0)) {
+            return error;
+        }
+    }
+
+    while (true) {
+        MessageData msgData;
+        msgData.name = chatName;
+        msgData.cursor = messageCache->getLastMessageId(chatName);
+        msgData.flag = true;
+        msgData.limit = syncPageLimit;
+        auto message = Message(MessageType::GetMessagesPage, msgData);
+
+        request(transport, message);
+        if (message.type == MessageType::ClientError || message.type == MessageType::ServerError) {
+            return message;
+        }
+
+        messageCache->insertMessages(chatName, message.data.chatMessages);
+        if (message.data.chatMessages.size() < static_cast<size_t>(syncPageLimit)) {
+            return std::nullopt;
         }
     }
+}
+
 
+// stops on request of its thread, which main's exit or exception makes
+auto notifier(std::stop_token stopToken, zmqpp::socket &subscribeSocket, ClientTransport &transport) -> void {
+    try {
+        while (!stopToken.stop_requested()) {
+            Envelope envelope;
+            Message notification;
+            try {
+                receiveMessage(subscribeSocket, envelope, notification);
+            } catch (std::runtime_error &) {
+                // receive timeout, lets stop request be checked
+                continue;
+            }
+
+            if (notification.type == MessageType::ChatAdded) {
+                // notification carries no chat, as anyone can subscribe to topic of user
+                try {
+                    fetchChats(transport, subscribeSocket);
+                } catch (std::runtime_error &exception) {
+                    std::cout << RED << exception.what() << RESET << std::endl;
+                }
+            } else if (notification.type == MessageType::NewMessage) {
+                // notification carries no message, it's fetched into cache when chat is shown
+                std::cout << "    new message in " << notification.data.name << std::endl;
+            }
+        }
+    } catch (...) {}
+
+    std::cout << "notifier stopped" << std::endl;
+}
+
+
+auto connectToServer(ClientTransport &transport) -> void {
     std::string password;
     int command;
     std::cout << "Choose:\n    1.Sign in\n    2.Sign up\nEnter number: ";
@@ -113,36 +234,30 @@ auto connectToServer(zmqpp::socket &serverSocket, zmqpp::socket &clientSocket) -
     std::cin >> password;
 
 
-    zmqpp::message connectMessage;
-    connectMessage << clientEndPoint;
-    if (!serverSocket.send(connectMessage, true)) {
-        throw std::runtime_error("send error");
-    }
-
     if (requestType == MessageType::SignIn) {
         auto request = Message(MessageType::SignIn, MessageData(username, password));
-        sendMessage(clientSocket, request);
+        request.compression = Compression::Zstd;
 
-        Message response;
-        receiveMessage(clientSocket, response);
+        const auto response = transport.request(request);
 
         if (response.authenticationStatus == AuthenticationStatus::NotExists) {
             throw std::runtime_error("user not exists");
         } else if (response.authenticationStatus == AuthenticationStatus::InvalidPassword) {
             throw std::runtime_error("invalid password");
         } else if (response.authenticationStatus == AuthenticationStatus::Success) {
+            sessionToken = response.data.buffer;
             std::cout << "sing in succeeded" << std::endl;
         }
     } else {
         auto request = Message(MessageType::SignUp, MessageData(username, password));
-        sendMessage(clientSocket, request);
+        request.compression = Compression::Zstd;
 
-        Message response;
-        receiveMessage(clientSocket, response);
+        const auto response = transport.request(request);
 
         if (response.authenticationStatus == AuthenticationStatus::Exists) {
             throw std::runtime_error("user exists");
         } else if (response.authenticationStatus == AuthenticationStatus::Success) {
+            sessionToken = response.data.buffer;
             std::cout << "sing up succeeded" << std::endl;
         }
     }
@@ -152,12 +267,22 @@ auto main() -> int {
     try {
         zmqpp::context context;
 
-        zmqpp::socket serverSocket(context, zmqpp::socket_type::push);
-        zmqpp::socket clientSocket(context, zmqpp::socket_type::request);
+        ClientTransport transport(context, serverEndPoint, std::chrono::milliseconds(receiveTimeout));
+        zmqpp::socket subscribeSocket(context, zmqpp::socket_type::subscribe);
+
+        connectToServer(transport);
+        messageCache = std::make_unique<MessageCache>("cache-" + username + ".db");
 
-        connectToServer(serverSocket, clientSocket);
+        // subscribe before loading chats, so none created in between is missed;
+        // chats are loaded before notifier starts, as subscribing and receiving must be on one thread
+        subscribeSocket.set(zmqpp::socket_option::receive_timeout, receiveTimeout);
+        subscribeSocket.set(zmqpp::socket_option::receive_high_water_mark, notificationsCapacity);
+        subscribeSocket.connect(notificationsEndPoint);
+        subscribeSocket.subscribe(userTopic(username));
+        loadChats(transport, subscribeSocket);
 
-        std::thread updaterThread(updater, std::ref(clientSocket));
+        // declared after sockets, so it's stopped and joined before they're closed on any exit
+        std::jthread notifierThread(notifier, std::ref(subscribeSocket), std::ref(transport));
         int32_t command;
         while (true) {
             std::cout << "Choose:\n"
@@ -169,6 +294,7 @@ auto main() -> int {
             std::cin >> command;
 
             if (command == 1) {
+                std::lock_guard lockGuard(chatsMutex);
                 for (const auto &chat: chats) {
                     std::cout << "    " << chat << std::endl;
                 }
@@ -194,10 +320,7 @@ auto main() -> int {
 
                 auto message = Message(MessageType::CreateChat, msgData);
 
-                mutex.lock();
-                sendMessage(clientSocket, message);
-                receiveMessage(clientSocket, message);
-                mutex.unlock();
+                request(transport, message);
 
                 if (message.type == MessageType::ClientError) {
                     std::cout << RED << message.data.buffer << RESET << std::endl;
@@ -209,12 +332,15 @@ auto main() -> int {
                 std::cout << "Enter chat name: ";
                 std::cin >> chatName;
 
+                // id of oldest shown message, 0 when there are no older ones
+                int64_t olderCursor{};
                 while (true) {
                     std::cout << "Choose:\n"
                                  "    1. Send message\n"
                                  "    2. Show messages\n"
-                                 "    3. Invite user\n"
-                                 "    4. Exit menu\n"
+                                 "    3. Show older messages\n"
+                                 "    4. Invite user\n"
+                                 "    5. Exit menu\n"
                                  "Enter num: ";
                     std::cin >> command;
 
@@ -229,36 +355,44 @@ auto main() -> int {
                         msgData.buffer = data;
                         auto message = Message(MessageType::CreateMessage, msgData);
 
-                        mutex.lock();
-                        sendMessage(clientSocket, message);
-                        receiveMessage(clientSocket, message);
-                        mutex.unlock();
+                        request(transport, message);
 
                         if (message.type == MessageType::ClientError) {
                             std::cout << RED << message.data.buffer << RESET << std::endl;
                         } else if (message.type == MessageType::ServerError) {
                             std::cout << RED << "Server error" << RESET << std::endl;
                         }
-                    } else if (command == 2) {
-                        MessageData msgData;
-                        msgData.name = chatName;
-                        auto message = Message(MessageType::GetAllMessagesFromChat, msgData);
+                    } else if (command == 2 || command == 3) {
+                        if (command == 3 && olderCursor == 0) {
+                            std::cout << "No older messages" << std::endl;
+                            continue;
+                        }
 
+                        // cached history has no gaps, older page is fetched only when cache runs out of it
+                        std::optional<Message> error;
+                        if (command == 2) {
+                            error = syncMessages(transport, chatName);
+                        } else if (const auto cacheCursor = messageCache->getOlderCursor(chatName);
+                                cacheCursor != 0 && messageCache->getMessages(chatName, olderCursor, pageLimit).size() <
+                                                    static_cast<size_t>(pageLimit)) {
+                            error = fetchOlderMessages(transport, chatName, cacheCursor);
+                        }
 
-                        mutex.lock();
-                        sendMessage(clientSocket, message);
-                        receiveMessage(clientSocket, message);
-                        mutex.unlock();
-                        if (message.type == MessageType::ClientError) {
-                            std::cout << RED << message.data.buffer << RESET << std::endl;
-                        } else if (message.type == MessageType::ServerError) {
+                        if (error && error->type == MessageType::ClientError) {
+                            std::cout << RED << error->data.buffer << RESET << std::endl;
+                            continue;
+                        } else if (error) {
                             std::cout << "Server error" << std::endl;
-                        } else {
-                            for (const auto &chatMessage: message.data.chatMessages) {
-                                std::cout << chatMessage << std::endl;
-                            }
+                            continue;
+                        }
+
+                        const auto messages = messageCache->getMessages(chatName, (command == 2) ? 0 : olderCursor,
+                                                                        pageLimit);
+                        for (const auto &chatMessage: messages) {
+                            std::cout << chatMessage << std::endl;
                         }
-                    } else if (command == 3) {
+                        olderCursor = (messages.size() < static_cast<size_t>(pageLimit)) ? 0 : messages.front().id;
+                    } else if (command == 4) {
                         std::string user;
                         std::cout << "Enter username: ";
                         std::cin >> user;
@@ -282,17 +416,14 @@ auto main() -> int {
                         auto message = Message(MessageType::InviteUserToChat, msgData);
 
 
-                        mutex.lock();
-                        sendMessage(clientSocket, message);
-                        receiveMessage(clientSocket, message);
-                        mutex.unlock();
+                        request(transport, message);
 
                         if (message.type == MessageType::ClientError) {
                             std::cout << RED << message.data.buffer << RESET << std::endl;
                         } else if (message.type == MessageType::ServerError) {
                             std::cout << RED << "Server error" << RESET << std::endl;
                         }
-                    } else if (command == 4) {
+                    } else if (command == 5) {
                         break;
                     } else {
                         std::cout << "Invalid command" << std::endl;
@@ -303,9 +434,7 @@ auto main() -> int {
             } else {
                 std::cout << "Invalid command" << std::endl;
             }
-
         }
-
     } catch (zmqpp::exception &exception) {
         std::cerr << "caught zmq exception: " << exception.what() << std::endl;
         exit(1);
@@ -0,0 +1,282 @@
+#include <new>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <unistd.h>
+#include <benchmark/benchmark.h>
+
+
+#include "lib/database.hpp"
+
+
+// usage: databaseBenchmark [--memory] [--shards=count] [--log] [benchmark flags]
+//
+// every benchmark runs on fresh database, in temp file by default, reports ops/s as items_per_second
+// and heap allocations per operation of all threads, including group commit thread
+
+
+static std::atomic<uint64_t> allocationsCount{0};
+
+
+auto operator new(size_t size) -> void * {
+    allocationsCount.fetch_add(1, std::memory_order_relaxed);
+    if (auto pointer = std::malloc(size == 0 ? 1 : size)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+
+auto operator delete(void *pointer) noexcept -> void {
+    std::free(pointer);
+}
+
+
+auto operator delete(void *pointer, size_t) noexcept -> void {
+    std::free(pointer);
+}
+
+
+// every connection pool gets its own named in-memory database, see ConnectionPool
+static bool inMemory{};
+
+static size_t shardsCount{};
+
+// messages go to message log next to database file, so it isn't combined with --memory
+static Database::MessageStorage messageStorage{Database::MessageStorage::Sqlite};
+
+static std::string databasePath{};
+
+static std::unique_ptr<Database> database{};
+
+static std::atomic<uint64_t> uniqueCounter{0};
+
+
+auto removeDatabaseFiles() -> void {
+    for (const auto *suffix: {"", "-wal", "-shm"}) {
+        std::filesystem::remove(databasePath + suffix);
+        for (size_t i = 0; i < shardsCount; i++) {
+            std::filesystem::remove(Database::getShardPath(databasePath, i) + suffix);
+        }
+    }
+    if (messageStorage == Database::MessageStorage::Log) {
+        std::filesystem::remove_all(Database::getMessageLogPath(databasePath));
+    }
+}
+
+
+auto makeDatabase() -> std::unique_ptr<Database> {
+    if (inMemory) {
+        return std::make_unique<Database>(":memory:", shardsCount, messageStorage);
+    }
+
+    databasePath = (std::filesystem::temp_directory_path() /
+                    ("cp-benchmark-" + std::to_string(getpid()) + "-" + std::to_string(uniqueCounter++) + ".db"));
+    removeDatabaseFiles();
+    return std::make_unique<Database>(databasePath, shardsCount, messageStorage);
+}
+
+
+auto removeDatabase() -> void {
+    database.reset();
+    if (!inMemory) {
+        removeDatabaseFiles();
+    }
+}
+
+
+auto createUsers(size_t count) -> std::vector<int32_t> {
+    std::vector<int32_t> ids;
+    ids.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        ids.push_back(database->createUser("user" + std::to_string(i), "password" + std::to_string(i)));
+    }
+    return ids;
+}
+
+
+// counts allocations of every thread between construction and report, so only first thread reports
+class AllocationsCounter {
+    benchmark::State &state;
+    uint64_t start{};
+
+public:
+    explicit AllocationsCounter(benchmark::State &state) : state(state),
+                                                           start(allocationsCount.load(std::memory_order_relaxed)) {}
+
+    auto report() -> void {
+        const auto count = (state.thread_index() == 0) ? allocationsCount.load(std::memory_order_relaxed) - start : 0;
+        state.counters["allocs"] = benchmark::Counter(static_cast<double>(count), benchmark::Counter::kAvgIterations);
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+    }
+};
+
+
+static auto createMessage(benchmark::State &state) -> void {
+    static std::vector<int32_t> userIds;
+    if (state.thread_index() == 0) {
+        database = makeDatabase();
+        userIds = createUsers(state.threads());
+        database->createChat("chat", userIds.front(), userIds);
+    }
+
+    const auto text = std::string(64, 'x');
+    AllocationsCounter allocationsCounter(state);
+    for (auto _: state) {
+        benchmark::DoNotOptimize(database->createMessage("chat", userIds[state.thread_index()], time(nullptr), text));
+    }
+    allocationsCounter.report();
+
+    if (state.thread_index() == 0) {
+        removeDatabase();
+    }
+}
+
+
+// every thread writes to own chat, so writes are spread over shards
+static auto createMessageInOwnChat(benchmark::State &state) -> void {
+    static std::vector<int32_t> userIds;
+    if (state.thread_index() == 0) {
+        database = makeDatabase();
+        userIds = createUsers(state.threads());
+        for (size_t i = 0; i < userIds.size(); i++) {
+            database->createChat("chat" + std::to_string(i), userIds[i], {userIds[i]});
+        }
+    }
+
+    const auto chatName = "chat" + std::to_string(state.thread_index());
+    const auto text = std::string(64, 'x');
+    AllocationsCounter allocationsCounter(state);
+    for (auto _: state) {
+        benchmark::DoNotOptimize(database->createMessage(chatName, userIds[state.thread_index()], time(nullptr), text));
+    }
+    allocationsCounter.report();
+
+    if (state.thread_index() == 0) {
+        removeDatabase();
+    }
+}
+
+
+static auto getAllMessagesFromChat(benchmark::State &state) -> void {
+    static int32_t userId;
+    if (state.thread_index() == 0) {
+        database = makeDatabase();
+        userId = createUsers(1).front();
+        database->createChat("chat", userId, {userId});
+        database->configureGroupCommit(1024, std::chrono::microseconds(0));
+        for (int64_t i = 0; i < state.range(0); i++) {
+            database->createMessage("chat", userId, time(nullptr), "message " + std::to_string(i));
+        }
+    }
+
+    AllocationsCounter allocationsCounter(state);
+    for (auto _: state) {
+        benchmark::DoNotOptimize(database->getAllMessagesFromChat("chat", userId));
+    }
+    allocationsCounter.report();
+
+    if (state.thread_index() == 0) {
+        removeDatabase();
+    }
+}
+
+
+static auto getChatsByTime(benchmark::State &state) -> void {
+    static int32_t userId;
+    if (state.thread_index() == 0) {
+        database = makeDatabase();
+        userId = createUsers(1).front();
+        for (int64_t i = 0; i < state.range(0); i++) {
+            database->createChat("chat" + std::to_string(i), userId, {userId});
+        }
+    }
+
+    AllocationsCounter allocationsCounter(state);
+    for (auto _: state) {
+        benchmark::DoNotOptimize(database->getChatsByTime(userId, 0));
+    }
+    allocationsCounter.report();
+
+    if (state.thread_index() == 0) {
+        removeDatabase();
+    }
+}
+
+
+static auto createChat(benchmark::State &state) -> void {
+    static std::vector<int32_t> userIds;
+    if (state.thread_index() == 0) {
+        database = makeDatabase();
+        userIds = createUsers(state.range(0));
+    }
+
+    AllocationsCounter allocationsCounter(state);
+    for (auto _: state) {
+        const auto chatName = "chat" + std::to_string(uniqueCounter++);
+        benchmark::DoNotOptimize(database->createChat(chatName, userIds.front(), userIds));
+    }
+    allocationsCounter.report();
+
+    if (state.thread_index() == 0) {
+        removeDatabase();
+    }
+}
+
+
+static auto authenticateUser(benchmark::State &state) -> void {
+    constexpr size_t usersCount = 1000;
+    if (state.thread_index() == 0) {
+        database = makeDatabase();
+        createUsers(usersCount);
+    }
+
+    size_t i = state.thread_index();
+    AllocationsCounter allocationsCounter(state);
+    for (auto _: state) {
+        const auto index = std::to_string(i++ % usersCount);
+        benchmark::DoNotOptimize(database->authenticateUser("user" + index, "password" + index));
+    }
+    allocationsCounter.report();
+
+    if (state.thread_index() == 0) {
+        removeDatabase();
+    }
+}
+
+
+BENCHMARK(createMessage)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(createMessageInOwnChat)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(getAllMessagesFromChat)->RangeMultiplier(10)->Range(10, 10000)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(getChatsByTime)->RangeMultiplier(10)->Range(10, 1000)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(createChat)->RangeMultiplier(10)->Range(10, 1000)->ThreadRange(1, 4)->UseRealTime();
+BENCHMARK(authenticateUser)->ThreadRange(1, 16)->UseRealTime();
+
+
+auto main(int argc, char *argv[]) -> int {
+    // own flags are removed before benchmark library reports unrecognized ones
+    int benchmarkArgc = 0;
+    for (int i = 0; i < argc; i++) {
+        if (std::strcmp(argv[i], "--memory") == 0) {
+            inMemory = true;
+        } else if (std::strncmp(argv[i], "--shards=", 9) == 0) {
+            shardsCount = std::stoul(argv[i] + 9);
+        } else if (std::strcmp(argv[i], "--log") == 0) {
+            messageStorage = Database::MessageStorage::Log;
+        } else {
+            argv[benchmarkArgc++] = argv[i];
+        }
+    }
+
+    benchmark::Initialize(&benchmarkArgc, argv);
+    if (benchmark::ReportUnrecognizedArguments(benchmarkArgc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
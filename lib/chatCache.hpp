@@ -0,0 +1,54 @@
+#ifndef CP_CHAT_CACHE_HPP
+#define CP_CHAT_CACHE_HPP
+
+
+#include <ctime>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+
+
+// Thread-safe, chat metadata: chat name and id and AllowedRawTime of members.
+// Filled on reads and written through by Database on every change, a miss only means the value isn't loaded yet.
+// Entries expire after lifetime, so value changed by another process is reread even if its invalidation was lost
+class ChatCache {
+    template<class T>
+    struct Entry {
+        T value;
+        std::chrono::steady_clock::time_point loadTime;
+    };
+
+    const std::chrono::steady_clock::duration lifetime;
+
+    std::unordered_map<std::string, Entry<int32_t>> chatIds{};
+    std::unordered_map<int32_t, Entry<std::string>> chatNames{};
+    // AllowedRawTime of member by chat id and user id
+    std::unordered_map<int32_t, std::unordered_map<int32_t, Entry<time_t>>> chats{};
+    mutable std::shared_mutex mutex{};
+
+    template<class T>
+    auto getFresh(const Entry<T> &entry) const -> std::optional<T>;
+
+public:
+    explicit ChatCache(std::chrono::steady_clock::duration lifetime = std::chrono::minutes(1));
+
+    auto findChatId(const std::string &chatName) const -> std::optional<int32_t>;
+
+    auto findChatName(int32_t chatId) const -> std::optional<std::string>;
+
+    auto findAllowedRawTime(int32_t chatId, int32_t userId) const -> std::optional<time_t>;
+
+    auto insertChat(const std::string &chatName, int32_t chatId) -> void;
+
+    auto insertMember(int32_t chatId, int32_t userId, time_t allowedRawTime) -> void;
+
+    // replaces members of chat with complete list
+    auto insertMembers(int32_t chatId, const std::vector<std::pair<int32_t, time_t>> &members) -> void;
+};
+
+
+#endif //CP_CHAT_CACHE_HPP
@@ -3,6 +3,8 @@
 
 
 #include <string>
+#include <cstdint>
+#include <vector>
 #include <utility>
 #include <iostream>
 #include <msgpack.hpp>
@@ -12,6 +14,8 @@ struct ChatMessage {
     std::string datetime{};
     std::string username{};
     std::string text{};
+    // increases within chat, used as history cursor
+    int64_t id{};
 
     ChatMessage() = default;
 
@@ -19,13 +23,26 @@ struct ChatMessage {
                                                                                 username(std::move(username)),
                                                                                 text(std::move(text)) {}
 
+    ChatMessage(int64_t id, std::string datetime, std::string username, std::string text) : ChatMessage(
+            std::move(datetime), std::move(username), std::move(text)) {
+        this->id = id;
+    }
+
     friend auto operator<<(std::ostream &os, const ChatMessage &chatMessage) -> std::ostream& {
-        const auto [datetime, username, text] = chatMessage;
+        const auto &[datetime, username, text, id] = chatMessage;
         os << "| " << datetime << " / " << username << "> " << text;
         return os;
     }
 
-    MSGPACK_DEFINE (datetime, username, text)
+    MSGPACK_DEFINE (datetime, username, text, id)
+};
+
+
+// one page of chat history, messages are ordered by id
+struct MessagesPage {
+    std::vector<ChatMessage> messages{};
+    // cursor of next page in same direction, 0 if older messages are exhausted
+    int64_t nextCursor{};
 };
 
 
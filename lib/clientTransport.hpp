@@ -0,0 +1,71 @@
+#ifndef CP_CLIENT_TRANSPORT_HPP
+#define CP_CLIENT_TRANSPORT_HPP
+
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+#include <cstdint>
+#include <unordered_map>
+#include <zmqpp/zmqpp.hpp>
+
+
+#include "messaging.hpp"
+
+
+// Thread-safe, client side of router endpoint over DEALER socket owned by I/O thread.
+// Many requests are in flight at once, responses are matched to them by requestId
+class ClientTransport {
+    zmqpp::context &context;
+    const std::string serverEndPoint;
+    const std::chrono::milliseconds timeout;
+
+    // callers hand requests to I/O thread through inproc queue, as zmq sockets aren't thread-safe
+    const std::string queueEndPoint;
+    zmqpp::socket queueSocket;
+    std::mutex queueMutex{};
+
+    struct Pending {
+        std::promise<Message> response;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    std::unordered_map<uint64_t, Pending> pending{};
+    std::mutex pendingMutex{};
+    std::atomic<uint64_t> nextRequestId{1};
+
+    std::atomic<bool> running{true};
+    std::thread ioThread{};
+
+    auto ioLoop() noexcept -> void;
+
+    // fails pending requests, whose deadline is before given time, with error
+    auto expire(std::chrono::steady_clock::time_point now, const char *error) -> void;
+
+    auto cancel(uint64_t requestId) -> void;
+
+    // assigns request id to message and hands it to I/O thread
+    auto queue(Message &message) -> std::future<Message>;
+
+public:
+    ClientTransport(zmqpp::context &context, std::string serverEndPoint, std::chrono::milliseconds timeout);
+
+    ClientTransport(const ClientTransport &) = delete;
+
+    auto operator=(const ClientTransport &) -> ClientTransport & = delete;
+
+    ~ClientTransport();
+
+    // assigns request id and queues request, future is ready when response arrives,
+    // or throws runtime_error once timeout passes without it, like lost reply of request
+    auto send(Message message) -> std::future<Message>;
+
+    // waits for response, throws on timeout
+    auto request(Message message) -> Message;
+};
+
+
+#endif //CP_CLIENT_TRANSPORT_HPP
@@ -0,0 +1,135 @@
+#ifndef CP_CONNECTION_HPP
+#define CP_CONNECTION_HPP
+
+
+#include <mutex>
+#include <tuple>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <concepts>
+#include <sqlite3.h>
+#include <type_traits>
+#include <unordered_map>
+
+
+auto bind(sqlite3_stmt *sqlite3Stmt, int32_t index, const char *value) noexcept -> bool;
+
+template<std::integral T>
+auto bind(sqlite3_stmt *sqlite3Stmt, int32_t index, T value) noexcept -> bool {
+    if constexpr (sizeof(T) <= sizeof(int32_t)) {
+        return sqlite3_bind_int(sqlite3Stmt, index, value) == SQLITE_OK;
+    } else {
+        return sqlite3_bind_int64(sqlite3Stmt, index, value) == SQLITE_OK;
+    }
+}
+
+
+template<class T, size_t index = 0>
+auto bindTuple(
+        sqlite3_stmt *sqlite3Stmt,
+        const T &tuple
+) noexcept -> typename std::enable_if<index >= std::tuple_size<T>::value, bool>::type {
+    return true;
+}
+
+
+template<class T, size_t index = 0>
+auto bindTuple(
+        sqlite3_stmt *sqlite3Stmt,
+        const T &tuple
+) noexcept -> typename std::enable_if<index < std::tuple_size<T>::value, bool>::type {
+    auto value = std::get<index>(tuple);
+    return bind(sqlite3Stmt, index + 1, value) && bindTuple<T, index + 1>(sqlite3Stmt, tuple);
+}
+
+
+// Cached prepared statement, resets on destruction so it doesn't keep read transaction open
+class Statement {
+    sqlite3_stmt *stmt{};
+
+public:
+    explicit Statement(sqlite3_stmt *stmt) noexcept : stmt(stmt) {}
+
+    Statement(const Statement &) = delete;
+
+    auto operator=(const Statement &) -> Statement & = delete;
+
+    ~Statement() {
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+    }
+
+    operator sqlite3_stmt *() const noexcept {
+        return stmt;
+    }
+
+    template<class... Args>
+    auto bind(Args... args) noexcept -> bool {
+        return bindTuple(stmt, std::make_tuple(args...));
+    }
+
+    auto step() noexcept -> int {
+        return sqlite3_step(stmt);
+    }
+};
+
+
+// Not thread-safe, single sqlite3 connection with prepared statement cache
+class Connection {
+    sqlite3 *db{};
+
+    // prepared once per query, finalized in destructor
+    std::unordered_map<std::string, sqlite3_stmt *> statements{};
+
+public:
+    Connection(const std::string &path, int flags);
+
+    Connection(const Connection &) = delete;
+
+    auto operator=(const Connection &) -> Connection & = delete;
+
+    ~Connection();
+
+    // takes statement from cache or prepares it
+    auto prepare(const char *sqlQuery) -> Statement;
+
+    auto execute(const std::string &sql) noexcept -> bool;
+
+    auto handle() const noexcept -> sqlite3 *;
+};
+
+
+// Thread-safe, WAL journaled database with one writer connection and one read-only connection per thread,
+// which is closed when its thread exits
+class ConnectionPool {
+    struct Readers {
+        std::unordered_map<std::thread::id, std::unique_ptr<Connection>> connections{};
+        std::mutex mutex{};
+    };
+
+    // unique per pool, so thread local lookups never hit connection of destroyed pool
+    const uint64_t id;
+    std::string path;
+
+    Connection writerConnection;
+    std::mutex writerMutex{};
+
+    // shared with threads, so exiting thread releases its reader only while pool is alive
+    std::shared_ptr<Readers> readers;
+
+    static auto resolvePath(const std::string &path) -> std::string;
+
+public:
+    explicit ConnectionPool(const std::string &path);
+
+    // explicitly locks writer until returned lock is released
+    auto writer() -> std::pair<std::unique_lock<std::mutex>, Connection &>;
+
+    // locks only on first call from thread, when connection is opened
+    auto reader() -> Connection &;
+};
+
+
+#endif //CP_CONNECTION_HPP
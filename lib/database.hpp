@@ -3,90 +3,173 @@
 
 
 #include <set>
-#include <mutex>
+#include <memory>
 #include <string>
+#include <optional>
 #include <vector>
-#include <sqlite3.h>
 #include <msgpack.hpp>
 
 #include "user.hpp"
 #include "auth.hpp"
+#include "chatCache.hpp"
+#include "connection.hpp"
+#include "groupCommit.hpp"
+#include "migrations.hpp"
+#include "messageLog.hpp"
 #include "chatMessage.hpp"
+#include "userDirectory.hpp"
 
 
-// Thread-safe, based on sqlite3
+// Thread-safe, based on sqlite3, reads run in parallel on per-thread connections, writes are serialized per file.
+// Users and Chats are kept in central file, Messages and ChatsInfo of chat are kept in shard chosen by chat id;
+// unsharded database has one shard, which is central file
 class Database {
-    sqlite3 *db{};
-    char *err_msg{};
-    sqlite3_stmt *stmt{};
-    std::mutex mutex{};
+public:
+    // where messages are kept, users, chats and memberships are always kept in sqlite
+    enum class MessageStorage {
+        Sqlite,
+        // append-only memory-mapped files in directory next to central file, used by one process only
+        Log
+    };
+
+private:
+    // own writer per shard, so writes to chats of different shards don't wait for each other
+    struct Shard {
+        // null when shard is central file
+        std::unique_ptr<ConnectionPool> ownedPool;
+        ConnectionPool &pool;
+
+        // messages of concurrent senders are inserted in shared transactions
+        GroupCommit groupCommit;
+
+        explicit Shard(ConnectionPool &pool);
+
+        explicit Shard(const std::string &path);
+    };
+
+    ConnectionPool pool;
 
-    // doesn't lock, must be locked outside
-    auto prepareStatement(const char *sqlQuery) noexcept -> bool;
+    std::vector<std::unique_ptr<Shard>> shards{};
 
-    // doesn't lock, must be locked outside
-    template<class... Args>
-    auto bindStatement(Args... args) noexcept -> bool;
+    // null when messages are kept in Messages tables of shards
+    std::unique_ptr<MessageLog> messageLog{};
+
+    auto getShard(int32_t chatId) -> Shard &;
+
+    auto isSharded() const -> bool;
 
     // doesn't lock
     static auto getFormattedDatetime(time_t rawTime) noexcept -> std::string;
 
-    // explicitly locks
-    auto executeSqlQuery(const std::string &sql) noexcept -> bool;
-
-    // explicitly locks
+    // doesn't lock, reads on thread's connection
     auto getUserPassword(const std::string &username) -> std::string;
 
-    // implicitly locks by getUserId
+    // doesn't lock, reads on thread's connection
     auto isUserExist(const std::string &username) -> bool;
 
-    // explicitly locks
+    // reads from chats cache, falls back to thread's connection
     auto getChatId(const std::string &chatName) -> int32_t;
 
-    // implicitly locks by getChatId
+    // doesn't lock, reads on thread's connection
     auto isChatExists(const std::string &chatName) -> bool;
 
-    // doesn't lock, must be locked outside
+    // every user, filled on start and kept current by createUser
+    UserDirectory users{};
+
+    // chat ids and memberships, kept current by createChat and inviteUserToChat
+    ChatCache chats{};
+
+    // reads from users directory, falls back to thread's connection
     auto getUsername(int id) -> std::string;
 
+    // doesn't lock, reads every member of chat on thread's connection of chat's shard
+    auto readChatMembers(int32_t chatId) -> std::vector<std::pair<int32_t, time_t>>;
+
+    // fills username of every message by sender id from users directory, misses are read one by one
+    auto resolveSenders(std::vector<ChatMessage> &messages, const std::vector<int32_t> &senderIds) -> void;
+
 public:
     Database();
 
-    explicit Database(const std::string &path);
+    // shardsCount 0 keeps every table in central file; count and storage can't be changed once database has chats
+    explicit Database(
+            const std::string &path,
+            size_t shardsCount = 0,
+            MessageStorage messageStorage = MessageStorage::Sqlite
+    );
+
+    // file of shard next to central one, e.g. database-shard-0.db
+    static auto getShardPath(const std::string &path, size_t index) -> std::string;
 
-    ~Database();
+    // directory of message log next to central file, e.g. database-messages
+    static auto getMessageLogPath(const std::string &path) -> std::string;
 
-    // explicitly locks
+    // doesn't lock, reads on thread's connection
     auto getUserId(const std::string &username) -> int32_t;
 
-    // explicitly locks
+    // doesn't lock, reads on thread's connection
     auto getAllUsers() -> std::set<User>;
 
-    // implicitly locks by isUserExists and getUserPassword
+    // doesn't lock, reads on thread's connection
     auto authenticateUser(const std::string &username, const std::string &password) -> AuthenticationStatus;
 
-    // explicitly locks
-    auto createUser(const std::string &username, const std::string &password) -> void;
+    // doesn't lock, thread-safe directory of all users
+    auto getUserDirectory() const -> const UserDirectory &;
 
-    // explicitly and implicitly locks
+    // locks writer, returns id of new user or -1 if username is taken
+    auto createUser(const std::string &username, const std::string &password) -> int32_t;
+
+    // locks writer, then writer of chat's shard when database is sharded
     auto createChat(const std::string &chatName, const int32_t &adminId, const std::vector<int32_t> &userIds) -> bool;
 
-    // explicitly locks
+    // reads from chats cache, falls back to thread's connection
     auto getChatName(int chatId) -> std::string;
 
-    // explicitly and implicitly locks
+    // doesn't lock, reads on thread's connections of every shard
     auto getChatsByTime(int32_t userId, time_t rawTime) -> std::vector<std::string>;
 
-    // explicitly and implicitly locks
-    auto createMessage(const std::string &chatName, int32_t senderId, time_t rawTime, const std::string &data) -> bool;
+    // batch closes on size or delay, see GroupCommit
+    auto configureGroupCommit(size_t maxBatchSize, std::chrono::microseconds maxBatchDelay) -> void;
 
-    // explicitly and implicitly locks
+    // waits for group commit of message, returns stored message or nullopt if chat doesn't exist
+    auto createMessage(
+            const std::string &chatName,
+            int32_t senderId,
+            time_t rawTime,
+            const std::string &data
+    ) -> std::optional<ChatMessage>;
+
+    // waits for group commit of messages given as chat name and data, ones of same shard are inserted in one write;
+    // returns for every message stored one or nullopt if its chat doesn't exist
+    auto createMessages(
+            int32_t senderId,
+            time_t rawTime,
+            const std::vector<std::pair<std::string, std::string>> &messages
+    ) -> std::vector<std::optional<ChatMessage>>;
+
+    // doesn't lock, reads on thread's connection
     auto getAllMessagesFromChat(const std::string &chatName, int32_t userId) -> std::vector<ChatMessage>;
 
-    // explicitly and implicitly locks
+    // doesn't lock, reads on thread's connection
+    // cursor 0 starts from newest message going back and from oldest going forward
+    auto getMessagesPage(
+            const std::string &chatName,
+            int32_t userId,
+            int64_t cursor,
+            int32_t limit,
+            bool forward
+    ) -> MessagesPage;
+
+    // doesn't lock, rereads user, which may be created by another process sharing files, into users directory
+    auto reloadUser(const std::string &username) -> void;
+
+    // doesn't lock, rereads chat and its members changed by another process sharing files into chats cache
+    auto reloadChat(const std::string &chatName) -> void;
+
+    // reads from chats cache, falls back to thread's connection
     auto getUserAllowedRawTime(int32_t chatId, int32_t userId) -> time_t;
 
-    // explicitly and implicitly locks
+    // locks writer of chat's shard
     auto inviteUserToChat(
             const std::string &chatName,
             int32_t invitorId,
@@ -0,0 +1,68 @@
+#ifndef CP_GROUP_COMMIT_HPP
+#define CP_GROUP_COMMIT_HPP
+
+
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+
+#include "connection.hpp"
+
+
+// Thread-safe, commits writes of concurrent callers together in one transaction on pool's writer
+class GroupCommit {
+public:
+    using Write = std::function<void(Connection &)>;
+
+private:
+    struct PendingWrite {
+        Write write;
+        std::promise<void> committed;
+    };
+
+    ConnectionPool &pool;
+
+    size_t maxBatchSize;
+    std::chrono::microseconds maxBatchDelay;
+
+    std::deque<PendingWrite> queue{};
+    std::mutex mutex{};
+    std::condition_variable condition{};
+    bool stopping{};
+
+    std::thread committer;
+
+    auto commitLoop() -> void;
+
+    // locks writer, every write runs in own savepoint so failed one doesn't abort others
+    auto commit(std::vector<PendingWrite> &batch) -> void;
+
+public:
+    // batch is closed when it has maxBatchSize writes or maxBatchDelay passed since its first write,
+    // with zero delay batch takes writes queued while previous one was committing
+    explicit GroupCommit(
+            ConnectionPool &pool,
+            size_t maxBatchSize = 256,
+            std::chrono::microseconds maxBatchDelay = std::chrono::microseconds::zero()
+    );
+
+    GroupCommit(const GroupCommit &) = delete;
+
+    auto operator=(const GroupCommit &) -> GroupCommit & = delete;
+
+    ~GroupCommit();
+
+    auto configure(size_t maxBatchSize, std::chrono::microseconds maxBatchDelay) -> void;
+
+    // blocks until write is committed, rethrows exception of write or commit
+    auto submit(Write write) -> void;
+};
+
+
+#endif //CP_GROUP_COMMIT_HPP
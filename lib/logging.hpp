@@ -0,0 +1,144 @@
+#ifndef CP_LOGGING_HPP
+#define CP_LOGGING_HPP
+
+
+#include <list>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <sstream>
+#include <condition_variable>
+
+
+enum class LogLevel {
+    Debug,
+    Info,
+    Warning,
+    Error,
+    Off
+};
+
+
+// records below it are compiled out, set with -DCP_LOG_LEVEL=0 to keep debug records
+#ifndef CP_LOG_LEVEL
+#define CP_LOG_LEVEL 1
+#endif
+
+constexpr auto compiledLogLevel = static_cast<LogLevel>(CP_LOG_LEVEL);
+
+
+// parses debug, info, warning, error or off, throws on anything else
+auto parseLogLevel(const std::string &name) -> LogLevel;
+
+
+// Asynchronous logger, every thread appends records to own lock-free ring buffer,
+// background thread drains buffers and writes records to stdout.
+// Records are dropped and counted when buffer is full, so logging never blocks caller
+class Logger {
+    struct Record {
+        std::chrono::system_clock::time_point time{};
+        LogLevel level{};
+        std::string text{};
+    };
+
+    // single producer is owning thread, single consumer is flusher
+    struct ThreadBuffer {
+        static constexpr size_t capacity = 1024;
+
+        std::array<Record, capacity> records{};
+        std::atomic<size_t> head{};
+        std::atomic<size_t> tail{};
+        std::atomic<bool> closed{};
+        std::thread::id threadId{std::this_thread::get_id()};
+
+        auto push(Record &&record) noexcept -> bool;
+    };
+
+    // closes buffer when thread exits, flusher removes it once drained
+    struct ThreadBufferOwner {
+        std::shared_ptr<ThreadBuffer> buffer;
+
+        ~ThreadBufferOwner();
+    };
+
+    std::atomic<LogLevel> level{compiledLogLevel};
+    std::atomic<uint64_t> droppedCount{};
+
+    // locked only on registration of thread and by flusher
+    std::mutex buffersMutex{};
+    std::list<std::shared_ptr<ThreadBuffer>> buffers{};
+
+    std::mutex flusherMutex{};
+    std::condition_variable flusherCondition{};
+    bool stopping{};
+    std::thread flusher{};
+
+    Logger();
+
+    auto getThreadBuffer() -> ThreadBuffer &;
+
+    // writes every buffered record, returns false if nothing was written
+    auto drain() -> bool;
+
+    auto runFlusher() -> void;
+
+public:
+    static constexpr std::chrono::milliseconds flushInterval{50};
+
+    static auto get() -> Logger &;
+
+    ~Logger();
+
+    auto setLevel(LogLevel newLevel) noexcept -> void;
+
+    auto isEnabled(LogLevel recordLevel) const noexcept -> bool {
+        return recordLevel >= level.load(std::memory_order_relaxed);
+    }
+
+    auto write(LogLevel recordLevel, std::string text) noexcept -> void;
+};
+
+
+template<LogLevel recordLevel, class... Args>
+auto writeLog(const Args &...args) -> void {
+    if constexpr (recordLevel >= compiledLogLevel) {
+        auto &logger = Logger::get();
+        if (logger.isEnabled(recordLevel)) {
+            std::ostringstream stream;
+            (stream << ... << args);
+            logger.write(recordLevel, stream.str());
+        }
+    }
+}
+
+
+// per-request chatter, compiled out by default
+template<class... Args>
+auto logDebug(const Args &...args) -> void {
+    writeLog<LogLevel::Debug>(args...);
+}
+
+
+template<class... Args>
+auto logInfo(const Args &...args) -> void {
+    writeLog<LogLevel::Info>(args...);
+}
+
+
+template<class... Args>
+auto logWarning(const Args &...args) -> void {
+    writeLog<LogLevel::Warning>(args...);
+}
+
+
+template<class... Args>
+auto logError(const Args &...args) -> void {
+    writeLog<LogLevel::Error>(args...);
+}
+
+
+#endif //CP_LOGGING_HPP
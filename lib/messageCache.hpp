@@ -0,0 +1,56 @@
+#ifndef CP_MESSAGE_CACHE_HPP
+#define CP_MESSAGE_CACHE_HPP
+
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+#include "connection.hpp"
+#include "chatMessage.hpp"
+
+
+// Thread-safe, client's on-disk copy of chats and messages of one user in sqlite3 file.
+// Empty chat is seeded with newest page, then synced forward from newest cached id and extended back by older pages,
+// so cached messages have no gaps between oldest cursor of chat and newest one
+class MessageCache {
+    Connection connection;
+    std::mutex mutex{};
+
+    // doesn't lock, caller runs it in transaction, false on sqlite error
+    auto insertMessagesInTransaction(const std::string &chatName, const std::vector<ChatMessage> &messages) -> bool;
+
+    // doesn't lock, caller runs it in transaction
+    auto commit(bool succeeded) -> void;
+
+public:
+    explicit MessageCache(const std::string &path);
+
+    auto getChats() -> std::vector<std::string>;
+
+    auto insertChat(const std::string &chatName) -> void;
+
+    // id of newest cached message of chat, 0 if there are none
+    auto getLastMessageId(const std::string &chatName) -> int64_t;
+
+    // inserts in one transaction, messages that are already cached are skipped
+    auto insertMessages(const std::string &chatName, const std::vector<ChatMessage> &messages) -> void;
+
+    // id of oldest cached message while older ones aren't cached, 0 when cache reaches first message of chat
+    auto getOlderCursor(const std::string &chatName) -> int64_t;
+
+    // inserts page older than cached messages and moves oldest cursor of chat in one transaction
+    auto insertOlderMessages(
+            const std::string &chatName,
+            const std::vector<ChatMessage> &messages,
+            int64_t olderCursor
+    ) -> void;
+
+    // newest messages with id below beforeId in ascending order, beforeId 0 starts from newest message
+    auto getMessages(const std::string &chatName, int64_t beforeId, int32_t limit) -> std::vector<ChatMessage>;
+};
+
+
+#endif //CP_MESSAGE_CACHE_HPP
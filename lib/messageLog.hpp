@@ -0,0 +1,165 @@
+#ifndef CP_MESSAGE_LOG_HPP
+#define CP_MESSAGE_LOG_HPP
+
+
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <shared_mutex>
+#include <unordered_map>
+
+
+#include "chatMessage.hpp"
+
+
+// Thread-safe, messages of every chat appended to own memory-mapped segment files in directory.
+// Ids of chat are 1, 2, 3..., so message is found by id through sparse index of every blockSize-th record;
+// reads copy fields straight from mapping. Appends of chat are serialized by its lock, reads of chat run in parallel.
+// Mapping is shared, so appended messages outlive crash of process, but not of host, unlike sqlite storage.
+// Files are closed once mapped, so open chats don't hold descriptors
+class MessageLog {
+    // segment file starts small and doubles up to segmentSize, so chat with few messages has small file
+    static constexpr uint64_t initialSegmentSize = 64 * 1024;
+    static constexpr uint64_t segmentSize = 64 * 1024 * 1024;
+    static constexpr int64_t blockSize = 64;
+
+    // record is header, datetime and data padded to 8 bytes, it never spans segments
+    struct RecordHeader {
+        // size of whole record, 0 where segment ends; written last, so unfinished append is never read
+        uint32_t size;
+        int32_t senderId;
+        int64_t rawTime;
+        uint32_t datetimeSize;
+        uint32_t dataSize;
+    };
+
+    // Not thread-safe, file mapped for reads and writes
+    class Segment {
+        const std::string path;
+        char *data{};
+        uint64_t size{};
+
+    public:
+        // file is created zero filled when it doesn't exist
+        explicit Segment(std::string path);
+
+        Segment(const Segment &) = delete;
+
+        auto operator=(const Segment &) -> Segment & = delete;
+
+        ~Segment();
+
+        // extends file zero filled to at least minimumSize, mapping may move
+        auto grow(uint64_t minimumSize) -> void;
+
+        auto at(uint64_t offset) const noexcept -> char * {
+            return data + offset;
+        }
+
+        auto getSize() const noexcept -> uint64_t {
+            return size;
+        }
+    };
+
+    struct Position {
+        size_t segment{};
+        uint64_t offset{};
+    };
+
+    // first record of block, ids of block b are b * blockSize + 1 and following
+    struct Block {
+        Position position{};
+        // lets reads skip blocks that are older than history visible to user
+        int64_t maxRawTime{};
+    };
+
+    struct ChatLog {
+        std::vector<std::unique_ptr<Segment>> segments{};
+        std::vector<Block> blocks{};
+        int64_t lastId{};
+        // end of last record in last segment
+        uint64_t tail{};
+        std::shared_mutex mutex{};
+    };
+
+    const std::string directory;
+
+    // index of chat is kept by one process, so log isn't shared between server processes
+    int lockFd{-1};
+
+    std::unordered_map<int32_t, std::unique_ptr<ChatLog>> chats{};
+    std::shared_mutex chatsMutex{};
+
+    auto getSegmentPath(int32_t chatId, size_t index) const -> std::string;
+
+    // opens existing segments of chat on first use
+    auto getChatLog(int32_t chatId) -> ChatLog &;
+
+    // fills index of chat from its segments; segment ends at empty record, log ends at first invalid one,
+    // then rest of its segment is zeroed and following segments are removed, so they are never read as records
+    auto load(int32_t chatId, ChatLog &chatLog) const -> void;
+
+    enum class RecordState {
+        // record fits in segment and its fields fit in record
+        Valid,
+        // empty record or no room for header, segment ends here
+        End,
+        // torn or corrupt record
+        Invalid
+    };
+
+    static auto checkRecord(const Segment &segment, uint64_t offset) noexcept -> RecordState;
+
+    // doesn't lock, returns position of record after one at position; records of index are checked by load or
+    // written by append of this process, so they aren't checked again
+    static auto next(const ChatLog &chatLog, Position position) noexcept -> Position;
+
+    static auto getRecord(const ChatLog &chatLog, Position position) noexcept -> const RecordHeader *;
+
+    // doesn't lock, appends messages of block with id in [firstId, lastId] visible from allowedRawTime
+    static auto readBlock(
+            const ChatLog &chatLog,
+            int64_t block,
+            int64_t firstId,
+            int64_t lastId,
+            time_t allowedRawTime,
+            std::vector<ChatMessage> &messages,
+            std::vector<int32_t> &senderIds
+    ) -> void;
+
+public:
+    // throws if directory is used by another process
+    explicit MessageLog(std::string directory);
+
+    MessageLog(const MessageLog &) = delete;
+
+    auto operator=(const MessageLog &) -> MessageLog & = delete;
+
+    ~MessageLog();
+
+    // returns id of appended message
+    auto append(
+            int32_t chatId,
+            int32_t senderId,
+            time_t rawTime,
+            const std::string &datetime,
+            const std::string &data
+    ) -> int64_t;
+
+    // messages ordered by id, with rawTime not before allowedRawTime; sender of every message is put into senderIds.
+    // Forward page starts after cursor, backward page ends before cursor, cursor 0 is oldest or newest end
+    auto read(
+            int32_t chatId,
+            time_t allowedRawTime,
+            int64_t cursor,
+            int32_t limit,
+            bool forward,
+            std::vector<ChatMessage> &messages,
+            std::vector<int32_t> &senderIds
+    ) -> void;
+};
+
+
+#endif //CP_MESSAGE_LOG_HPP
@@ -3,6 +3,7 @@
 
 
 #include <string>
+#include <vector>
 #include <cstddef>
 #include <zmqpp/zmqpp.hpp>
 #include <msgpack.hpp>
@@ -23,10 +24,33 @@ enum class MessageType {
     GetAllMessagesFromChat,
     InviteUserToChat,
     ClientError,
-    ServerError
+    ServerError,
+    // server-push notifications, ChatAdded is published on topic of user without chat, as anyone can subscribe to
+    // topic; user fetches own chats with UpdateChats;
+    // NewMessage is published on topic of chat, name is chat and cursor is id of new message, which isn't included,
+    // as anyone can subscribe to topic; members fetch it with GetMessagesPage
+    ChatAdded,
+    NewMessage,
+    // name is chat, cursor is message id, flag selects newer messages, limit is page size
+    GetMessagesPage,
+    // server metrics in Prometheus text format are returned in buffer
+    Stats,
+    // restores session from token in buffer, which SignIn, SignUp and Resume return in buffer on success
+    Resume,
+    // sub-requests are in batch, their responses are returned in batch in same order
+    Batch,
+    // published between server processes on invalidationTopic of internal bus of broker,
+    // name is chat changed in shared storage
+    ChatInvalidated
 };
 
 
+auto getMessageTypeName(MessageType type) -> std::string;
+
+// false for value outside of MessageType, which is unpacked from any int client sends
+auto isKnownMessageType(MessageType type) -> bool;
+
+
 struct MessageData {
     int32_t time{};
     std::string name{};
@@ -34,6 +58,8 @@ struct MessageData {
     bool flag{};
     std::vector<std::string> vector{};
     std::vector<ChatMessage> chatMessages{};
+    int64_t cursor{};
+    int32_t limit{};
 
     MessageData() = default;
 
@@ -45,7 +71,23 @@ struct MessageData {
     MessageData(std::string username, std::string buffer) : name(std::move(username)),
                                                             buffer(std::move(buffer)) {}
 
-    MSGPACK_DEFINE (time, name, buffer, flag, vector, chatMessages)
+    MSGPACK_DEFINE (time, name, buffer, flag, vector, chatMessages, cursor, limit)
+};
+
+
+// Wire encoding of Message. Server replies in encoding of request, so clients of both encodings are served
+enum class WireFormat {
+    // whole Message with every MessageData field as msgpack array, the only one old clients understand
+    Legacy,
+    // protocol version byte followed by type and only fields that differ from default
+    Compact
+};
+
+
+// Payload compression, client offers it in SignIn/SignUp and server accepts it in response
+enum class Compression {
+    None,
+    Zstd
 };
 
 
@@ -53,6 +95,14 @@ struct Message {
     MessageType type{};
     AuthenticationStatus authenticationStatus{};
     MessageData data{};
+    // isn't serialized, set by receiveMessage and used by sendMessage
+    WireFormat format{WireFormat::Compact};
+    // negotiated compression, only in compact encoding; compact frames above threshold are compressed when set
+    Compression compression{};
+    // only in compact encoding, chosen by client and copied into response, so pipelined responses are matched
+    uint64_t requestId{};
+    // only in compact encoding, sub-requests of Batch or their responses
+    std::vector<Message> batch{};
 
     Message() = default;
 
@@ -64,13 +114,36 @@ struct Message {
 };
 
 
-auto sendMessage(zmqpp::socket &socket, const Message &message) -> void;
+// routing frames ROUTER socket prepends to request, client identity and empty delimiter
+using Envelope = std::vector<std::string>;
+
+
+// send and receive return size of message frame in bytes
+
+auto sendMessage(zmqpp::socket &socket, const Message &message) -> size_t;
+
+auto receiveMessage(zmqpp::socket &socket, Message &message) -> size_t;
+
+// topic of notifications for user, terminated so that subscription to one username doesn't match another
+auto userTopic(const std::string &username) -> std::string;
+
+// topic of messages of chat, terminated like userTopic
+auto chatTopic(const std::string &chatName) -> std::string;
+
+// topic of cache invalidations between server processes
+auto invalidationTopic() -> std::string;
+
+
+// sends envelope frames followed by message, used to reply through ROUTER socket and to publish with topic
+auto sendMessage(zmqpp::socket &socket, const Envelope &envelope, const Message &message) -> size_t;
 
-auto receiveMessage(zmqpp::socket &socket, Message &message) -> void;
+// last frame is message, all frames before it are stored into envelope
+auto receiveMessage(zmqpp::socket &socket, Envelope &envelope, Message &message) -> size_t;
 
 
 MSGPACK_ADD_ENUM(MessageType)
 MSGPACK_ADD_ENUM(AuthenticationStatus)
+MSGPACK_ADD_ENUM(Compression)
 
 
 #endif //CP_MESSAGING_HPP
@@ -0,0 +1,100 @@
+#ifndef CP_METRICS_HPP
+#define CP_METRICS_HPP
+
+
+#include <map>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <functional>
+
+
+// Thread-safe, monotonic counter
+class Counter {
+    std::atomic<uint64_t> value{};
+
+public:
+    auto add(uint64_t count = 1) noexcept -> void {
+        value.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    auto get() const noexcept -> uint64_t {
+        return value.load(std::memory_order_relaxed);
+    }
+};
+
+
+// Thread-safe latency histogram, bucket upper bounds are powers of two from 1us to ~8s
+class Histogram {
+    static constexpr size_t bucketsCount = 24;
+
+    // last bucket counts observations above every bound
+    std::array<std::atomic<uint64_t>, bucketsCount + 1> buckets{};
+    std::atomic<uint64_t> sumNanoseconds{};
+
+    friend class Metrics;
+
+public:
+    auto observe(std::chrono::nanoseconds duration) noexcept -> void;
+};
+
+
+// observes time from construction to destruction
+class ScopedTimer {
+    Histogram &histogram;
+    const std::chrono::steady_clock::time_point start{std::chrono::steady_clock::now()};
+
+public:
+    explicit ScopedTimer(Histogram &histogram) : histogram(histogram) {}
+
+    ScopedTimer(const ScopedTimer &) = delete;
+
+    auto operator=(const ScopedTimer &) -> ScopedTimer & = delete;
+
+    ~ScopedTimer() {
+        histogram.observe(std::chrono::steady_clock::now() - start);
+    }
+};
+
+
+// Thread-safe registry of process metrics, rendered in Prometheus text exposition format.
+// Lookup locks registry, so callers keep returned references, which stay valid for lifetime of process
+class Metrics {
+    template<class T>
+    struct Family {
+        std::string help{};
+        // keyed by labels, e.g. type="SignIn"
+        std::map<std::string, std::unique_ptr<T>> series{};
+    };
+
+    struct Gauge {
+        std::string help{};
+        std::function<double()> read{};
+    };
+
+    std::mutex mutex{};
+    std::map<std::string, Family<Counter>> counters{};
+    std::map<std::string, Family<Histogram>> histograms{};
+    std::map<std::string, Gauge> gauges{};
+
+    Metrics() = default;
+
+public:
+    static auto get() -> Metrics &;
+
+    auto counter(const std::string &name, const std::string &help, const std::string &labels = "") -> Counter &;
+
+    auto histogram(const std::string &name, const std::string &help, const std::string &labels = "") -> Histogram &;
+
+    // read is called on every render, from thread that renders
+    auto gauge(const std::string &name, const std::string &help, std::function<double()> read) -> void;
+
+    auto render() -> std::string;
+};
+
+
+#endif //CP_METRICS_HPP
@@ -0,0 +1,20 @@
+#ifndef CP_MIGRATIONS_HPP
+#define CP_MIGRATIONS_HPP
+
+
+#include <vector>
+
+
+#include "connection.hpp"
+
+
+// Schema version is stored in PRAGMA user_version and equals number of applied migrations,
+// so existing database files are upgraded in place. Migrations are only ever appended.
+using Migrations = std::vector<const char *>;
+
+
+// doesn't lock, connection must be writer; applies every pending migration in own transaction
+auto migrate(Connection &connection, const Migrations &migrations) -> void;
+
+
+#endif //CP_MIGRATIONS_HPP
@@ -7,5 +7,8 @@
 
 auto getIP() -> std::string;
 
+// end point from environment variable, e.g. ipc:///tmp/cp-server-1 to run several servers on one host
+auto getEndPoint(const char *variable, const std::string &defaultEndPoint) -> std::string;
+
 
 #endif //CP_NETWORKING_HPP
@@ -0,0 +1,61 @@
+#ifndef CP_PUBLISHER_HPP
+#define CP_PUBLISHER_HPP
+
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <condition_variable>
+#include <zmqpp/zmqpp.hpp>
+
+
+#include "metrics.hpp"
+#include "messaging.hpp"
+
+
+// Thread-safe, publishes messages on PUB socket owned by own thread, so callers never wait for sends.
+// Queue of publisher and queue of every subscriber are bounded, what doesn't fit is dropped
+class Publisher {
+    zmqpp::socket socket;
+    const size_t capacity;
+
+    // topic and message
+    std::deque<std::pair<std::string, Message>> queue{};
+    std::mutex mutex{};
+    std::condition_variable condition{};
+    bool stopping{};
+
+    std::thread publisherThread{};
+
+    Counter &dropped;
+
+    auto publishLoop() noexcept -> void;
+
+    auto start() -> void;
+
+public:
+    // subscriberCapacity is high water mark of socket, messages to subscriber that is slower are dropped by zmq
+    Publisher(zmqpp::context &context, size_t capacity, int subscriberCapacity);
+
+    Publisher(const Publisher &) = delete;
+
+    auto operator=(const Publisher &) -> Publisher & = delete;
+
+    ~Publisher();
+
+    // binds socket and starts publishing, messages queued before are kept
+    auto bind(const std::string &endPoint) -> void;
+
+    // connects socket to XSUB socket of broker and starts publishing, messages queued before are kept
+    auto connect(const std::string &endPoint) -> void;
+
+    // drops message if queue is full
+    auto publish(std::string topic, Message message) -> void;
+
+    auto size() -> size_t;
+};
+
+
+#endif //CP_PUBLISHER_HPP
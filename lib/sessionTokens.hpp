@@ -0,0 +1,33 @@
+#ifndef CP_SESSION_TOKENS_HPP
+#define CP_SESSION_TOKENS_HPP
+
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <optional>
+#include <sodium.h>
+
+
+#include "user.hpp"
+
+
+// Thread-safe, issues tokens carrying user id, username and expiry time signed with crypto_auth,
+// so session is restored from token alone, without reading users from database.
+// Key is kept in file, tokens stay valid across server restarts and between servers sharing the file
+class SessionTokens {
+    std::array<unsigned char, crypto_auth_KEYBYTES> key{};
+    std::chrono::seconds lifetime;
+
+public:
+    // reads key from keyPath, generates and writes new one if file doesn't exist
+    explicit SessionTokens(const std::string &keyPath, std::chrono::seconds lifetime = std::chrono::hours(24 * 7));
+
+    auto issue(const User &user) const -> std::string;
+
+    // returns user of token that is signed with key and isn't expired
+    auto verify(const std::string &token) const -> std::optional<User>;
+};
+
+
+#endif //CP_SESSION_TOKENS_HPP
@@ -0,0 +1,73 @@
+#include <mutex>
+
+
+#include "../chatCache.hpp"
+
+
+ChatCache::ChatCache(std::chrono::steady_clock::duration lifetime) : lifetime(lifetime) {}
+
+
+template<class T>
+auto ChatCache::getFresh(const Entry<T> &entry) const -> std::optional<T> {
+    // expired entry is left in place, it's replaced when value is reread
+    if (std::chrono::steady_clock::now() - entry.loadTime > lifetime) {
+        return std::nullopt;
+    }
+    return entry.value;
+}
+
+
+auto ChatCache::findChatId(const std::string &chatName) const -> std::optional<int32_t> {
+    std::shared_lock lock(mutex);
+    if (auto it = chatIds.find(chatName); it != chatIds.end()) {
+        return getFresh(it->second);
+    }
+    return std::nullopt;
+}
+
+
+auto ChatCache::findChatName(int32_t chatId) const -> std::optional<std::string> {
+    std::shared_lock lock(mutex);
+    if (auto it = chatNames.find(chatId); it != chatNames.end()) {
+        return getFresh(it->second);
+    }
+    return std::nullopt;
+}
+
+
+auto ChatCache::findAllowedRawTime(int32_t chatId, int32_t userId) const -> std::optional<time_t> {
+    std::shared_lock lock(mutex);
+    if (auto chat = chats.find(chatId); chat != chats.end()) {
+        if (auto it = chat->second.find(userId); it != chat->second.end()) {
+            return getFresh(it->second);
+        }
+    }
+    return std::nullopt;
+}
+
+
+auto ChatCache::insertChat(const std::string &chatName, int32_t chatId) -> void {
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard lockGuard(mutex);
+    chatIds.insert_or_assign(chatName, Entry<int32_t>{chatId, now});
+    chatNames.insert_or_assign(chatId, Entry<std::string>{chatName, now});
+}
+
+
+auto ChatCache::insertMember(int32_t chatId, int32_t userId, time_t allowedRawTime) -> void {
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard lockGuard(mutex);
+    chats[chatId].insert_or_assign(userId, Entry<time_t>{allowedRawTime, now});
+}
+
+
+auto ChatCache::insertMembers(int32_t chatId, const std::vector<std::pair<int32_t, time_t>> &members) -> void {
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard lockGuard(mutex);
+    // members removed by another process leave cache, member inserted meanwhile is read again on miss
+    auto &chat = chats[chatId];
+    chat.clear();
+    for (const auto &[userId, allowedRawTime]: members) {
+        chat.emplace(userId, Entry<time_t>{allowedRawTime, now});
+    }
+}
@@ -0,0 +1,159 @@
+#include <utility>
+#include <stdexcept>
+
+
+#include "../clientTransport.hpp"
+
+
+// how often I/O thread checks whether transport is destroyed
+constexpr long pollInterval = 100;
+
+
+static std::atomic<uint64_t> transportsCounter{0};
+
+
+ClientTransport::ClientTransport(
+        zmqpp::context &context,
+        std::string serverEndPoint,
+        std::chrono::milliseconds timeout
+) : context(context), serverEndPoint(std::move(serverEndPoint)), timeout(timeout),
+    queueEndPoint("inproc://client-transport-" + std::to_string(transportsCounter++)),
+    queueSocket(context, zmqpp::socket_type::push) {
+    queueSocket.set(zmqpp::socket_option::send_timeout, static_cast<int>(timeout.count()));
+    // inproc connect before bind is queued until I/O thread binds
+    queueSocket.connect(queueEndPoint);
+
+    ioThread = std::thread(&ClientTransport::ioLoop, this);
+}
+
+
+ClientTransport::~ClientTransport() {
+    running = false;
+    ioThread.join();
+}
+
+
+auto ClientTransport::ioLoop() noexcept -> void {
+    try {
+        zmqpp::socket pullSocket(context, zmqpp::socket_type::pull);
+        pullSocket.bind(queueEndPoint);
+
+        zmqpp::socket dealerSocket(context, zmqpp::socket_type::dealer);
+        dealerSocket.connect(serverEndPoint);
+
+        zmqpp::poller poller;
+        poller.add(pullSocket);
+        poller.add(dealerSocket);
+
+        // sweeps pending requests once per poll interval, so busy socket doesn't scan them on every message
+        auto nextSweep = std::chrono::steady_clock::now();
+        while (running) {
+            const auto polled = poller.poll(pollInterval);
+            if (const auto now = std::chrono::steady_clock::now(); now >= nextSweep) {
+                expire(now, "receive timeout");
+                nextSweep = now + std::chrono::milliseconds(pollInterval);
+            }
+            if (!polled) {
+                continue;
+            }
+
+            if (poller.has_input(pullSocket)) {
+                zmqpp::message request;
+                pullSocket.receive(request);
+                dealerSocket.send(request);
+            }
+
+            if (poller.has_input(dealerSocket)) {
+                Envelope envelope;
+                Message response;
+                try {
+                    receiveMessage(dealerSocket, envelope, response);
+                } catch (zmqpp::exception &) {
+                    throw;
+                } catch (std::exception &) {
+                    // malformed response can't be matched, its request times out
+                    continue;
+                }
+
+                std::lock_guard lockGuard(pendingMutex);
+                if (auto it = pending.find(response.requestId); it != pending.end()) {
+                    it->second.response.set_value(std::move(response));
+                    pending.erase(it);
+                }
+            }
+        }
+    } catch (std::exception &) {
+        // pending requests fail at once, new ones fail on send
+        running = false;
+        expire(std::chrono::steady_clock::time_point::max(), "transport stopped");
+    }
+}
+
+
+auto ClientTransport::expire(std::chrono::steady_clock::time_point now, const char *error) -> void {
+    std::lock_guard lockGuard(pendingMutex);
+    for (auto it = pending.begin(); it != pending.end();) {
+        if (it->second.deadline > now) {
+            ++it;
+            continue;
+        }
+        it->second.response.set_exception(std::make_exception_ptr(std::runtime_error(error)));
+        it = pending.erase(it);
+    }
+}
+
+
+auto ClientTransport::cancel(uint64_t requestId) -> void {
+    std::lock_guard lockGuard(pendingMutex);
+    pending.erase(requestId);
+}
+
+
+auto ClientTransport::queue(Message &message) -> std::future<Message> {
+    if (!running) {
+        throw std::runtime_error("transport stopped");
+    }
+
+    message.requestId = nextRequestId++;
+    // requestId is carried only by compact encoding
+    message.format = WireFormat::Compact;
+
+    std::future<Message> response;
+    {
+        std::lock_guard lockGuard(pendingMutex);
+        // checked again under lock, as stopping I/O thread expires pending requests only once
+        if (!running) {
+            throw std::runtime_error("transport stopped");
+        }
+        auto &entry = pending[message.requestId];
+        entry.deadline = std::chrono::steady_clock::now() + timeout;
+        response = entry.response.get_future();
+    }
+
+    try {
+        // empty delimiter frame makes request look like one of REQ socket to server
+        std::lock_guard lockGuard(queueMutex);
+        sendMessage(queueSocket, Envelope{""}, message);
+    } catch (...) {
+        cancel(message.requestId);
+        throw;
+    }
+
+    return response;
+}
+
+
+auto ClientTransport::send(Message message) -> std::future<Message> {
+    return queue(message);
+}
+
+
+auto ClientTransport::request(Message message) -> Message {
+    auto response = queue(message);
+    if (response.wait_for(timeout) != std::future_status::ready) {
+        // I/O thread expires request up to poll interval later, late response finds no pending request then
+        cancel(message.requestId);
+        throw std::runtime_error("receive timeout");
+    }
+    return response.get();
+}
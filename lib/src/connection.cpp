@@ -0,0 +1,147 @@
+#include <atomic>
+#include <stdexcept>
+
+
+#include "../metrics.hpp"
+#include "../connection.hpp"
+
+
+constexpr int32_t busyTimeout = 5 * 1000;
+
+
+auto bind(sqlite3_stmt *sqlite3Stmt, int32_t index, const char *value) noexcept -> bool {
+    return sqlite3_bind_text(sqlite3Stmt, index, value, -1, nullptr) == SQLITE_OK;
+}
+
+
+Connection::Connection(const std::string &path, int flags) {
+    if (sqlite3_open_v2(path.c_str(), &db, flags, nullptr) != SQLITE_OK) {
+        sqlite3_close(db);
+        throw std::runtime_error("sqlite3_open error");
+    }
+    sqlite3_busy_timeout(db, busyTimeout);
+}
+
+
+Connection::~Connection() {
+    for (auto &[sqlQuery, statement]: statements) {
+        sqlite3_finalize(statement);
+    }
+    sqlite3_close(db);
+}
+
+
+auto Connection::prepare(const char *sqlQuery) -> Statement {
+    if (auto it = statements.find(sqlQuery); it != statements.end()) {
+        return Statement(it->second);
+    }
+
+    sqlite3_stmt *stmt{};
+    if (sqlite3_prepare_v2(db, sqlQuery, -1, &stmt, nullptr) != SQLITE_OK) {
+        throw std::runtime_error("sqlite3_prepare_v2 error");
+    }
+
+    try {
+        statements.emplace(sqlQuery, stmt);
+    } catch (...) {
+        sqlite3_finalize(stmt);
+        throw;
+    }
+    return Statement(stmt);
+}
+
+
+auto Connection::execute(const std::string &sql) noexcept -> bool {
+    char *errMsg{};
+    const auto result = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errMsg);
+    if (errMsg) {
+        sqlite3_free(errMsg);
+    }
+    return result == SQLITE_OK;
+}
+
+
+auto Connection::handle() const noexcept -> sqlite3 * {
+    return db;
+}
+
+
+auto ConnectionPool::resolvePath(const std::string &path) -> std::string {
+    // every connection to plain :memory: is a separate database, so readers share named in-memory one
+    if (path == ":memory:") {
+        static std::atomic<int32_t> memoryDatabaseCounter{0};
+        return "file:cp-memory-" + std::to_string(memoryDatabaseCounter++) + "?mode=memory&cache=shared";
+    }
+    return path;
+}
+
+
+static std::atomic<uint64_t> connectionPoolCounter{0};
+
+
+ConnectionPool::ConnectionPool(const std::string &path) : id(connectionPoolCounter++),
+                                                          path(resolvePath(path)),
+                                                          writerConnection(this->path,
+                                                                           SQLITE_OPEN_READWRITE |
+                                                                           SQLITE_OPEN_CREATE |
+                                                                           SQLITE_OPEN_URI),
+                                                          readers(std::make_shared<Readers>()) {
+    // synchronous stays FULL, so committed transaction outlives power failure; group commit amortizes its fsync
+    if (!writerConnection.execute("PRAGMA journal_mode = WAL;") ||
+        !writerConnection.execute("PRAGMA synchronous = FULL;")) {
+        throw std::runtime_error("sqlite3_exec error");
+    }
+}
+
+
+auto ConnectionPool::writer() -> std::pair<std::unique_lock<std::mutex>, Connection &> {
+    static auto &lockWait = Metrics::get().histogram("cp_database_lock_wait_seconds",
+                                                     "Time spent waiting for database writer lock");
+
+    const auto start = std::chrono::steady_clock::now();
+    std::unique_lock lock(writerMutex);
+    lockWait.observe(std::chrono::steady_clock::now() - start);
+
+    return {std::move(lock), writerConnection};
+}
+
+
+auto ConnectionPool::reader() -> Connection & {
+    // connections of thread by pool id, released from pools that are still alive when thread exits,
+    // so neither thread per client leaks them nor recycled thread id gets stale one
+    struct ThreadReaders {
+        struct Entry {
+            Connection *connection;
+            std::weak_ptr<Readers> readers;
+        };
+
+        std::unordered_map<uint64_t, Entry> entries{};
+
+        ~ThreadReaders() {
+            for (auto &[poolId, entry]: entries) {
+                if (auto poolReaders = entry.readers.lock()) {
+                    std::lock_guard lockGuard(poolReaders->mutex);
+                    poolReaders->connections.erase(std::this_thread::get_id());
+                }
+            }
+        }
+    };
+
+    thread_local ThreadReaders threadReaders;
+    if (auto it = threadReaders.entries.find(id); it != threadReaders.entries.end()) {
+        return *it->second.connection;
+    }
+
+    std::lock_guard lockGuard(readers->mutex);
+    auto &connection = readers->connections[std::this_thread::get_id()];
+    if (!connection) {
+        connection = std::make_unique<Connection>(path, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_URI);
+        // shared cache in-memory database uses table locks instead of WAL
+        connection->execute("PRAGMA read_uncommitted = 1;");
+    }
+
+    // entries of destroyed pools are dropped here, so long living thread doesn't accumulate them
+    std::erase_if(threadReaders.entries, [](const auto &entry) { return entry.second.readers.expired(); });
+    threadReaders.entries.emplace(id, ThreadReaders::Entry{connection.get(), readers});
+    return *connection;
+}
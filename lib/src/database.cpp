@@ -1,41 +1,186 @@
-#include <tuple>
+#include <limits>
 #include <utility>
+#include <algorithm>
+#include <stdexcept>
 
 
+#include "../metrics.hpp"
 #include "../database.hpp"
 
 
-auto bind(sqlite3_stmt *&sqlite3Stmt, int32_t index, const char *value) noexcept -> bool {
-    return sqlite3_bind_text(sqlite3Stmt, index, value, -1, nullptr) == SQLITE_OK;
+constexpr int32_t maxPageLimit = 1000;
+
+
+static auto operationLatency(const std::string &operation) -> Histogram & {
+    return Metrics::get().histogram("cp_database_operation_seconds", "Latency of Database operations",
+                                    "operation=\"" + operation + "\"");
 }
 
 
-auto bind(sqlite3_stmt *&sqlite3Stmt, int32_t index, int32_t value) noexcept -> bool {
-    return sqlite3_bind_int(sqlite3Stmt, index, value) == SQLITE_OK;
+static const Migrations migrations = {
+        // 1: initial schema
+        "CREATE TABLE IF NOT EXISTS Users(Id INTEGER PRIMARY KEY AUTOINCREMENT, Username TEXT, Password TEXT);"
+        "CREATE TABLE IF NOT EXISTS Chats(Id INTEGER PRIMARY KEY AUTOINCREMENT, Name TEXT, AdminId INT, CreationRawTime INT);"
+        "CREATE TABLE IF NOT EXISTS ChatsInfo(ChatId INT, UserId INT, AllowedRawTime INT);"
+        "CREATE TABLE IF NOT EXISTS Messages(Id INTEGER PRIMARY KEY AUTOINCREMENT, ChatId INT, SenderId INT, RawTime INT, Time DATETIME, Data TEXT);",
+
+        // 2: unique usernames, chat names and memberships, indexes for hot queries;
+        // duplicates left by racing sign ups and chat creations are merged into the oldest row
+        "UPDATE Messages SET SenderId = (SELECT MIN(Id) FROM Users WHERE Username = "
+        "(SELECT Username FROM Users WHERE Id = Messages.SenderId));"
+        "UPDATE ChatsInfo SET UserId = (SELECT MIN(Id) FROM Users WHERE Username = "
+        "(SELECT Username FROM Users WHERE Id = ChatsInfo.UserId));"
+        "UPDATE Chats SET AdminId = (SELECT MIN(Id) FROM Users WHERE Username = "
+        "(SELECT Username FROM Users WHERE Id = Chats.AdminId));"
+        "DELETE FROM Users WHERE Id NOT IN (SELECT MIN(Id) FROM Users GROUP BY Username);"
+
+        "UPDATE Messages SET ChatId = (SELECT MIN(Id) FROM Chats WHERE Name = "
+        "(SELECT Name FROM Chats WHERE Id = Messages.ChatId));"
+        "UPDATE ChatsInfo SET ChatId = (SELECT MIN(Id) FROM Chats WHERE Name = "
+        "(SELECT Name FROM Chats WHERE Id = ChatsInfo.ChatId));"
+        "DELETE FROM Chats WHERE Id NOT IN (SELECT MIN(Id) FROM Chats GROUP BY Name);"
+
+        "DELETE FROM ChatsInfo WHERE rowid NOT IN (SELECT MIN(rowid) FROM ChatsInfo GROUP BY ChatId, UserId);"
+
+        "CREATE UNIQUE INDEX UsersByUsername ON Users(Username);"
+        "CREATE UNIQUE INDEX ChatsByName ON Chats(Name);"
+        "CREATE UNIQUE INDEX ChatsInfoByChatUser ON ChatsInfo(ChatId, UserId);"
+        "CREATE INDEX ChatsInfoByUser ON ChatsInfo(UserId, AllowedRawTime, ChatId);"
+        "CREATE INDEX MessagesByChatTime ON Messages(ChatId, RawTime);"
+        "CREATE INDEX MessagesByChatId ON Messages(ChatId, Id);",
+
+        // 3: settings, database without shards keeps messages in central file
+        "CREATE TABLE Settings(Name TEXT PRIMARY KEY, Value INT) WITHOUT ROWID;"
+        "INSERT INTO Settings(Name, Value) VALUES('ShardsCount', 0);",
+
+        // 4: storage of messages, 0 is Messages tables, 1 is message log
+        "INSERT INTO Settings(Name, Value) VALUES('MessageStorage', 0);"
+};
+
+
+// Messages and ChatsInfo of sharded database, same tables as in central file
+static const Migrations shardMigrations = {
+        // 1: initial schema
+        "CREATE TABLE ChatsInfo(ChatId INT, UserId INT, AllowedRawTime INT);"
+        "CREATE TABLE Messages(Id INTEGER PRIMARY KEY AUTOINCREMENT, ChatId INT, SenderId INT, RawTime INT, Time DATETIME, Data TEXT);"
+        "CREATE UNIQUE INDEX ChatsInfoByChatUser ON ChatsInfo(ChatId, UserId);"
+        "CREATE INDEX ChatsInfoByUser ON ChatsInfo(UserId, AllowedRawTime, ChatId);"
+        "CREATE INDEX MessagesByChatTime ON Messages(ChatId, RawTime);"
+        "CREATE INDEX MessagesByChatId ON Messages(ChatId, Id);"
+};
+
+
+// chats are mapped to shards by count and messages are found in storage by setting,
+// so settings are changed only while there are no chats
+static auto setSetting(Connection &connection, const std::string &name, int64_t value) -> void {
+    int64_t storedValue;
+    {
+        auto stmt = connection.prepare("SELECT Value FROM Settings WHERE Name = ?");
+        if (!stmt.bind(name.c_str())) {
+            throw std::runtime_error("sqlite3_bind_text error");
+        }
+        if (stmt.step() != SQLITE_ROW) {
+            throw std::runtime_error("sqlite3_step error");
+        }
+        storedValue = sqlite3_column_int64(stmt, 0);
+    }
+
+    if (storedValue == value) {
+        return;
+    }
+
+    {
+        auto stmt = connection.prepare("SELECT EXISTS(SELECT 1 FROM Chats)");
+        if (stmt.step() != SQLITE_ROW) {
+            throw std::runtime_error("sqlite3_step error");
+        }
+        if (sqlite3_column_int(stmt, 0) != 0) {
+            throw std::runtime_error("database has " + name + " " + std::to_string(storedValue));
+        }
+    }
+
+    auto stmt = connection.prepare("UPDATE Settings SET Value = ? WHERE Name = ?");
+    if (!stmt.bind(value, name.c_str())) {
+        throw std::runtime_error("sqlite3_bind_int error");
+    }
+    if (stmt.step() != SQLITE_DONE) {
+        throw std::runtime_error("sqlite3_step error");
+    }
 }
 
 
-template<class T, size_t index = 0>
-auto bindTuple(
-        sqlite3_stmt *&sqlite3Stmt,
-        const T &tuple
-) noexcept -> typename std::enable_if<index >= std::tuple_size<T>::value, bool>::type {
-    return true;
+// doesn't lock, connection must be writer of chat's shard; members after -1 are ignored
+static auto insertChatMembers(
+        Connection &connection,
+        int32_t chatId,
+        const std::vector<int32_t> &userIds,
+        time_t allowedRawTime
+) -> void {
+    const auto sqlQuery = "INSERT OR IGNORE INTO ChatsInfo(ChatId, UserId, AllowedRawTime) VALUES(?, ?, ?);";
+
+    for (const auto &userId : userIds) {
+        if (userId == -1) {
+            break;
+        }
+
+        auto stmt = connection.prepare(sqlQuery);
+        if (!stmt.bind(chatId, userId, allowedRawTime)) {
+            throw std::runtime_error("sqlite3_bind error");
+        }
+        if (stmt.step() != SQLITE_DONE) {
+            throw std::runtime_error("sqlite3_step error");
+        }
+    }
 }
 
 
-template<class T, size_t index = 0>
-auto bindTuple(
-        sqlite3_stmt *stmt,
-        const T &tuple
-) noexcept -> typename std::enable_if<index < std::tuple_size<T>::value, bool>::type {
-    auto value = std::get<index>(tuple);
-    return bind(stmt, index + 1, value) && bindTuple<T, index + 1>(stmt, tuple);
+Database::Shard::Shard(ConnectionPool &pool) : pool(pool), groupCommit(pool) {}
+
+
+Database::Shard::Shard(const std::string &path) : ownedPool(std::make_unique<ConnectionPool>(path)),
+                                                  pool(*ownedPool),
+                                                  groupCommit(pool) {
+    auto [lock, connection] = pool.writer();
+    migrate(connection, shardMigrations);
 }
 
 
-auto Database::executeSqlQuery(const std::string &sql) noexcept -> bool {
-    return sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &err_msg) == SQLITE_OK;
+auto Database::getShard(int32_t chatId) -> Shard & {
+    // chat that doesn't exist has id -1, it maps to some shard, which has no rows of it
+    return *shards[static_cast<uint32_t>(chatId) % shards.size()];
+}
+
+
+auto Database::isSharded() const -> bool {
+    return shards.front()->ownedPool != nullptr;
+}
+
+
+auto Database::getShardPath(const std::string &path, size_t index) -> std::string {
+    // every connection pool gets its own named in-memory database
+    if (path == ":memory:") {
+        return path;
+    }
+
+    const auto suffix = "-shard-" + std::to_string(index);
+    const auto extension = path.rfind('.');
+    if (extension == std::string::npos || path.find('/', extension) != std::string::npos) {
+        return path + suffix;
+    }
+    return path.substr(0, extension) + suffix + path.substr(extension);
+}
+
+
+auto Database::getMessageLogPath(const std::string &path) -> std::string {
+    if (path == ":memory:") {
+        throw std::runtime_error("message log needs database file");
+    }
+
+    const auto extension = path.rfind('.');
+    if (extension == std::string::npos || path.find('/', extension) != std::string::npos) {
+        return path + "-messages";
+    }
+    return path.substr(0, extension) + "-messages";
 }
 
 
@@ -53,22 +198,14 @@ auto Database::getFormattedDatetime(const time_t rawTime) noexcept -> std::strin
 }
 
 
-auto Database::prepareStatement(const char *sqlQuery) noexcept -> bool {
-    return sqlite3_prepare_v2(db, sqlQuery, -1, &stmt, nullptr) == SQLITE_OK;
-}
-
-
-template<class... Args>
-auto Database::bindStatement(Args... args) noexcept -> bool {
-    return bindTuple(stmt, std::make_tuple(args...));
-}
-
-
 auto Database::createChat(
         const std::string &chatName,
         const int32_t &adminId,
         const std::vector<int32_t> &userIds
 ) -> bool {
+    static auto &latency = operationLatency("createChat");
+    ScopedTimer timer(latency);
+
     if (isChatExists(chatName)) {
         return false;
     }
@@ -81,41 +218,84 @@ auto Database::createChat(
 
     const auto sqlChatsQuery = "INSERT INTO Chats(Name, AdminId, CreationRawTime) VALUES(?, ?, ?);";
 
-    mutex.lock();
-    if (!prepareStatement(sqlChatsQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
-    }
-
-    if (!bindStatement(chatName.c_str(), adminId, creationRawTime)) {
-        throw std::runtime_error("sqlite3_bind error");
+    auto [lock, connection] = pool.writer();
+    if (!connection.execute("BEGIN;")) {
+        throw std::runtime_error("sqlite3_exec error");
     }
 
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
-        throw std::runtime_error("sqlite3_step error");
-    }
+    int32_t chatId;
+    try {
+        int result;
+        {
+            auto stmt = connection.prepare(sqlChatsQuery);
+            if (!stmt.bind(chatName.c_str(), adminId, creationRawTime)) {
+                throw std::runtime_error("sqlite3_bind error");
+            }
 
-    mutex.unlock();
-    const auto chatId = getChatId(chatName);
-    mutex.lock();
+            result = stmt.step();
+            chatId = static_cast<int32_t>(sqlite3_last_insert_rowid(connection.handle()));
+        }
 
-    for (const auto &userId : userIds) {
-        const auto sqlChatsInfoQuery = "INSERT INTO ChatsInfo(ChatId, UserId, AllowedRawTime) VALUES(?, ?, ?);";
-        if (userId == -1) {
-            break;
+        if (result == SQLITE_CONSTRAINT) {
+            // chat with same name was created concurrently
+            connection.execute("ROLLBACK;");
+            return false;
         }
-        if (!prepareStatement(sqlChatsInfoQuery)) {
-            throw std::runtime_error("sqlite3_prepare_v2 error");
+        if (result != SQLITE_DONE) {
+            throw std::runtime_error("sqlite3_step error");
         }
 
-        if (!bindStatement(chatId, userId, creationRawTime)) {
-            throw std::runtime_error("sqlite3_bind error");
+        // without shards chat and its members are written in one transaction
+        if (!isSharded()) {
+            insertChatMembers(connection, chatId, userIds, creationRawTime);
         }
-        if (sqlite3_step(stmt) != SQLITE_DONE) {
-            throw std::runtime_error("sqlite3_step error");
+    } catch (...) {
+        connection.execute("ROLLBACK;");
+        throw;
+    }
+
+    if (!connection.execute("COMMIT;")) {
+        connection.execute("ROLLBACK;");
+        throw std::runtime_error("sqlite3_exec error");
+    }
+    lock.unlock();
+
+    if (isSharded()) {
+        try {
+            auto [shardLock, shardConnection] = getShard(chatId).pool.writer();
+            if (!shardConnection.execute("BEGIN;")) {
+                throw std::runtime_error("sqlite3_exec error");
+            }
+            try {
+                insertChatMembers(shardConnection, chatId, userIds, creationRawTime);
+            } catch (...) {
+                shardConnection.execute("ROLLBACK;");
+                throw;
+            }
+            if (!shardConnection.execute("COMMIT;")) {
+                shardConnection.execute("ROLLBACK;");
+                throw std::runtime_error("sqlite3_exec error");
+            }
+        } catch (...) {
+            // chat without members is removed, so its name can be taken again
+            auto [centralLock, centralConnection] = pool.writer();
+            auto stmt = centralConnection.prepare("DELETE FROM Chats WHERE Id = ?");
+            if (stmt.bind(chatId)) {
+                stmt.step();
+            }
+            throw;
         }
     }
 
-    mutex.unlock();
+    std::vector<std::pair<int32_t, time_t>> members;
+    for (const auto &userId : userIds) {
+        if (userId == -1) {
+            break;
+        }
+        members.emplace_back(userId, creationRawTime);
+    }
+    chats.insertChat(chatName, chatId);
+    chats.insertMembers(chatId, members);
 
     return true;
 }
@@ -124,16 +304,12 @@ auto Database::createChat(
 auto Database::getUserPassword(const std::string &username) -> std::string {
     const auto sqlQuery = "SELECT Password FROM Users WHERE Username = ?";
 
-    std::lock_guard lockGuard(mutex);
-    if (!prepareStatement(sqlQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
-    }
-
-    if (!bindStatement(username.c_str())) {
+    auto stmt = pool.reader().prepare(sqlQuery);
+    if (!stmt.bind(username.c_str())) {
         throw std::runtime_error("sqlite3_bind_text error");
     }
 
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
+    if (stmt.step() == SQLITE_ROW) {
         return reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
     } else {
         throw std::runtime_error("sqlite3_step error");
@@ -142,22 +318,27 @@ auto Database::getUserPassword(const std::string &username) -> std::string {
 
 
 auto Database::getChatId(const std::string &chatName) -> int32_t {
+    if (auto chatId = chats.findChatId(chatName)) {
+        return *chatId;
+    }
+
     const auto sqlQuery = "SELECT Id FROM Chats WHERE Name = ?";
 
-    std::lock_guard lockGuard(mutex);
-    if (!prepareStatement(sqlQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
-    }
+    int32_t chatId;
+    {
+        auto stmt = pool.reader().prepare(sqlQuery);
+        if (!stmt.bind(chatName.c_str())) {
+            throw std::runtime_error("sqlite3_bind_int error");
+        }
 
-    if (!bindStatement(chatName.c_str())) {
-        throw std::runtime_error("sqlite3_bind_int error");
+        if (stmt.step() != SQLITE_ROW) {
+            return -1;
+        }
+        chatId = sqlite3_column_int(stmt, 0);
     }
 
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        return sqlite3_column_int(stmt, 0);
-    } else {
-        return -1;
-    }
+    chats.insertChat(chatName, chatId);
+    return chatId;
 }
 
 
@@ -167,15 +348,15 @@ auto Database::isChatExists(const std::string &chatName) -> bool {
 
 
 auto Database::getAllUsers() -> std::set<User> {
+    static auto &latency = operationLatency("getAllUsers");
+    ScopedTimer timer(latency);
+
     const auto sqlQuery = "SELECT Id, Username FROM Users";
 
-    std::lock_guard lockGuard(mutex);
-    if (!prepareStatement(sqlQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
-    }
+    auto stmt = pool.reader().prepare(sqlQuery);
 
     std::set<User> users;
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
+    while (stmt.step() == SQLITE_ROW) {
         users.insert(
                 User(sqlite3_column_int(stmt, 0), reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)))
         );
@@ -186,6 +367,9 @@ auto Database::getAllUsers() -> std::set<User> {
 
 
 auto Database::authenticateUser(const std::string &username, const std::string &password) -> AuthenticationStatus {
+    static auto &latency = operationLatency("authenticateUser");
+    ScopedTimer timer(latency);
+
     if (isUserExist(username)) {
         if (getUserPassword(username) == password) {
             return AuthenticationStatus::Success;
@@ -198,51 +382,177 @@ auto Database::authenticateUser(const std::string &username, const std::string &
 }
 
 
-auto Database::getUserAllowedRawTime(int32_t chatId, int32_t userId) -> time_t {
-    const auto sqlQuery = "SELECT AllowedRawTime FROM ChatsInfo WHERE ChatId = ? AND UserId = ?";
+auto Database::getMessagesPage(
+        const std::string &chatName,
+        const int32_t userId,
+        const int64_t cursor,
+        const int32_t limit,
+        const bool forward
+) -> MessagesPage {
+    static auto &latency = operationLatency("getMessagesPage");
+    ScopedTimer timer(latency);
 
-    std::lock_guard lockGuard(mutex);
-    if (!prepareStatement(sqlQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
-    }
+    const auto chatId = getChatId(chatName);
+    const auto pageLimit = std::clamp(limit, 1, maxPageLimit);
 
-    if (!bindStatement(chatId, userId)) {
-        throw std::runtime_error("sqlite_bind error");
+    const auto sqlQueryForward = "SELECT Id, SenderId, Time, Data FROM Messages "
+                                 "WHERE ChatId = ? AND RawTime >= ? AND Id > ? ORDER BY Id LIMIT ?";
+    const auto sqlQueryBackward = "SELECT Id, SenderId, Time, Data FROM Messages "
+                                  "WHERE ChatId = ? AND RawTime >= ? AND Id < ? ORDER BY Id DESC LIMIT ?";
+
+    time_t allowedRawTime;
+    try {
+        allowedRawTime = getUserAllowedRawTime(chatId, userId);
+    } catch (std::runtime_error &) {
+        throw std::logic_error("Chat don't exists");
     }
 
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        return sqlite3_column_int(stmt, 0);
+    const auto from = (forward || cursor > 0) ? cursor : std::numeric_limits<int64_t>::max();
+
+    MessagesPage page;
+    std::vector<int32_t> senderIds;
+    if (messageLog) {
+        // log page is already ordered by id
+        messageLog->read(chatId, allowedRawTime, cursor, pageLimit, forward, page.messages, senderIds);
     } else {
-        throw std::runtime_error("sqlite3_step error");
+        auto stmt = getShard(chatId).pool.reader().prepare(forward ? sqlQueryForward : sqlQueryBackward);
+        if (!stmt.bind(chatId, allowedRawTime, from, pageLimit)) {
+            throw std::runtime_error("sqlite_bind error");
+        }
+
+        while (stmt.step() == SQLITE_ROW) {
+            page.messages.emplace_back(
+                    sqlite3_column_int64(stmt, 0),
+                    reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2)),
+                    std::string(),
+                    reinterpret_cast<const char *>(sqlite3_column_text(stmt, 3))
+            );
+            senderIds.push_back(sqlite3_column_int(stmt, 1));
+        }
+    }
+
+    if (!forward && !messageLog) {
+        std::reverse(page.messages.begin(), page.messages.end());
+        std::reverse(senderIds.begin(), senderIds.end());
+    }
+
+    resolveSenders(page.messages, senderIds);
+
+    if (forward) {
+        page.nextCursor = page.messages.empty() ? cursor : page.messages.back().id;
+    } else if (static_cast<int32_t>(page.messages.size()) == pageLimit) {
+        page.nextCursor = page.messages.front().id;
+    }
+
+    return page;
+}
+
+
+auto Database::readChatMembers(int32_t chatId) -> std::vector<std::pair<int32_t, time_t>> {
+    const auto sqlQuery = "SELECT UserId, AllowedRawTime FROM ChatsInfo WHERE ChatId = ?";
+
+    std::vector<std::pair<int32_t, time_t>> members;
+    auto stmt = getShard(chatId).pool.reader().prepare(sqlQuery);
+    if (!stmt.bind(chatId)) {
+        throw std::runtime_error("sqlite3_bind_int error");
+    }
+
+    while (stmt.step() == SQLITE_ROW) {
+        members.emplace_back(sqlite3_column_int(stmt, 0), sqlite3_column_int64(stmt, 1));
+    }
+    return members;
+}
+
+
+auto Database::reloadUser(const std::string &username) -> void {
+    if (const auto userId = getUserId(username); userId != -1) {
+        users.insert(User(userId, username));
     }
 }
 
 
+auto Database::reloadChat(const std::string &chatName) -> void {
+    const auto sqlQuery = "SELECT Id FROM Chats WHERE Name = ?";
+
+    int32_t chatId;
+    {
+        auto stmt = pool.reader().prepare(sqlQuery);
+        if (!stmt.bind(chatName.c_str())) {
+            throw std::runtime_error("sqlite3_bind_text error");
+        }
+
+        if (stmt.step() != SQLITE_ROW) {
+            return;
+        }
+        chatId = sqlite3_column_int(stmt, 0);
+    }
+
+    chats.insertChat(chatName, chatId);
+    chats.insertMembers(chatId, readChatMembers(chatId));
+}
+
+
+auto Database::getUserAllowedRawTime(int32_t chatId, int32_t userId) -> time_t {
+    static auto &latency = operationLatency("getUserAllowedRawTime");
+    ScopedTimer timer(latency);
+
+    if (auto allowedRawTime = chats.findAllowedRawTime(chatId, userId)) {
+        return *allowedRawTime;
+    }
+
+    const auto sqlQuery = "SELECT AllowedRawTime FROM ChatsInfo WHERE ChatId = ? AND UserId = ?";
+
+    time_t allowedRawTime;
+    {
+        auto stmt = getShard(chatId).pool.reader().prepare(sqlQuery);
+        if (!stmt.bind(chatId, userId)) {
+            throw std::runtime_error("sqlite_bind error");
+        }
+
+        if (stmt.step() != SQLITE_ROW) {
+            throw std::runtime_error("sqlite3_step error");
+        }
+        allowedRawTime = sqlite3_column_int64(stmt, 0);
+    }
+
+    chats.insertMember(chatId, userId, allowedRawTime);
+    return allowedRawTime;
+}
+
+
 auto Database::inviteUserToChat(
         const std::string &chatName,
         const int32_t invitorId,
         const int32_t userId,
         bool allowHistorySharing
 ) -> void {
+    static auto &latency = operationLatency("inviteUserToChat");
+    ScopedTimer timer(latency);
 
     const auto chatId = getChatId(chatName);
     const auto allowedRawTime = (allowHistorySharing) ?
                                 (getUserAllowedRawTime(chatId, invitorId)) : (time(nullptr));
 
-    const auto sqlQuery = "INSERT INTO ChatsInfo(ChatId, UserId, AllowedRawTime) VALUES(?, ?, ?);";
+    // inviting member again keeps its history visibility
+    const auto sqlQuery = "INSERT OR IGNORE INTO ChatsInfo(ChatId, UserId, AllowedRawTime) VALUES(?, ?, ?);";
 
-    std::lock_guard lockGuard(mutex);
-    if (!prepareStatement(sqlQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
-    }
+    {
+        auto [lock, connection] = getShard(chatId).pool.writer();
+        auto stmt = connection.prepare(sqlQuery);
+        if (!stmt.bind(chatId, userId, allowedRawTime)) {
+            throw std::runtime_error("sqlite3_bind_int error");
+        }
 
-    if (!bindStatement(chatId, userId, allowedRawTime)) {
-        throw std::runtime_error("sqlite3_bind_int error");
-    }
+        if (stmt.step() != SQLITE_DONE) {
+            throw std::runtime_error("sqlite3_step error");
+        }
 
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
-        throw std::runtime_error("sqlite3_step error");
+        if (sqlite3_changes(connection.handle()) == 0) {
+            return;
+        }
     }
+
+    chats.insertMember(chatId, userId, allowedRawTime);
 }
 
 
@@ -251,105 +561,225 @@ auto Database::createMessage(
         const int32_t senderId,
         const time_t rawTime,
         const std::string &data
-) -> bool {
+) -> std::optional<ChatMessage> {
+    static auto &latency = operationLatency("createMessage");
+    ScopedTimer timer(latency);
 
     const auto chatId = getChatId(chatName);
-    const auto formattedDatetime = getFormattedDatetime(rawTime);
     const auto sqlQuery = "INSERT INTO Messages(ChatId, SenderId, RawTime, Time, Data) VALUES(?, ?, ?, ?, ?)";
 
     if (chatId == -1) {
-        return false;
+        return std::nullopt;
     }
 
-    std::lock_guard lockGuard(mutex);
-    if (!prepareStatement(sqlQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
-    }
-    if (!bindStatement(chatId, senderId, rawTime, formattedDatetime.c_str(), data.c_str())) {
-        throw std::runtime_error("sqlite3_bind_int error");
-    }
+    auto sender = users.find(senderId);
+    ChatMessage message(getFormattedDatetime(rawTime), sender ? sender->username : "", data);
 
-    if (sqlite3_step(stmt) == SQLITE_DONE) {
-        return true;
-    } else {
-        throw std::runtime_error("sqlite3_step error");
+    if (messageLog) {
+        message.id = messageLog->append(chatId, senderId, rawTime, message.datetime, data);
+        return message;
     }
+
+    getShard(chatId).groupCommit.submit([&](Connection &connection) {
+        auto stmt = connection.prepare(sqlQuery);
+        if (!stmt.bind(chatId, senderId, rawTime, message.datetime.c_str(), data.c_str())) {
+            throw std::runtime_error("sqlite3_bind_int error");
+        }
+
+        if (stmt.step() != SQLITE_DONE) {
+            throw std::runtime_error("sqlite3_step error");
+        }
+        message.id = sqlite3_last_insert_rowid(connection.handle());
+    });
+
+    return message;
 }
 
 
-auto Database::getChatsByTime(const int32_t userId, const time_t rawTime) -> std::vector<std::string> {
-    const auto sqlQuery = "SELECT ChatId FROM ChatsInfo WHERE AllowedRawTime > ? AND UserId = ?";
+auto Database::createMessages(
+        const int32_t senderId,
+        const time_t rawTime,
+        const std::vector<std::pair<std::string, std::string>> &messages
+) -> std::vector<std::optional<ChatMessage>> {
+    static auto &latency = operationLatency("createMessages");
+    ScopedTimer timer(latency);
 
-    mutex.lock();
+    const auto formattedDatetime = getFormattedDatetime(rawTime);
+    const auto sqlQuery = "INSERT INTO Messages(ChatId, SenderId, RawTime, Time, Data) VALUES(?, ?, ?, ?, ?)";
 
-    if (!prepareStatement(sqlQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
+    const auto sender = users.find(senderId);
+    const auto senderName = sender ? sender->username : "";
+
+    std::vector<int32_t> chatIds;
+    std::vector<std::optional<ChatMessage>> created;
+    chatIds.reserve(messages.size());
+    created.reserve(messages.size());
+    for (const auto &[chatName, data]: messages) {
+        chatIds.push_back(getChatId(chatName));
+        if (chatIds.back() != -1) {
+            created.emplace_back(ChatMessage(formattedDatetime, senderName, data));
+        } else {
+            created.emplace_back(std::nullopt);
+        }
     }
 
-    if (!bindStatement(rawTime, userId)) {
-        throw std::runtime_error("sqlite3_bind_int error");
+    if (messageLog) {
+        for (size_t i = 0; i < messages.size(); i++) {
+            if (created[i]) {
+                created[i]->id = messageLog->append(chatIds[i], senderId, rawTime, formattedDatetime,
+                                                    messages[i].second);
+            }
+        }
+        return created;
     }
 
-    std::vector<int> chatIds;
-    for (int i = 0; sqlite3_step(stmt) == SQLITE_ROW; i++) {
-        const auto chatId = sqlite3_column_int(stmt, 0);
-        chatIds.push_back(chatId);
+    // shards are written one after another, messages of each in one write
+    for (auto &shard: shards) {
+        const auto isInShard = [&](size_t i) { return created[i] && &getShard(chatIds[i]) == shard.get(); };
+
+        bool hasMessages = false;
+        for (size_t i = 0; i < messages.size() && !hasMessages; i++) {
+            hasMessages = isInShard(i);
+        }
+        if (!hasMessages) {
+            continue;
+        }
+
+        shard->groupCommit.submit([&](Connection &connection) {
+            for (size_t i = 0; i < messages.size(); i++) {
+                if (!isInShard(i)) {
+                    continue;
+                }
+
+                auto stmt = connection.prepare(sqlQuery);
+                if (!stmt.bind(chatIds[i], senderId, rawTime, formattedDatetime.c_str(),
+                               messages[i].second.c_str())) {
+                    throw std::runtime_error("sqlite3_bind_int error");
+                }
+
+                if (stmt.step() != SQLITE_DONE) {
+                    throw std::runtime_error("sqlite3_step error");
+                }
+                created[i]->id = sqlite3_last_insert_rowid(connection.handle());
+            }
+        });
     }
 
-    mutex.unlock();
+    return created;
+}
+
 
-    std::vector<std::string> chats;
-    chats.reserve(chatIds.size());
-    for (const auto &chatId: chatIds) {
-        // getChatName locks
-        chats.push_back(getChatName(chatId));
+auto Database::configureGroupCommit(size_t maxBatchSize, std::chrono::microseconds maxBatchDelay) -> void {
+    for (auto &shard: shards) {
+        shard->groupCommit.configure(maxBatchSize, maxBatchDelay);
     }
+}
+
 
-    return chats;
+auto Database::getChatsByTime(const int32_t userId, const time_t rawTime) -> std::vector<std::string> {
+    static auto &latency = operationLatency("getChatsByTime");
+    ScopedTimer timer(latency);
+
+    const auto sqlQuery = "SELECT ChatId FROM ChatsInfo WHERE UserId = ? AND AllowedRawTime > ?";
+
+    // memberships are in shards and names in central file, names are mostly served by chats cache
+    std::vector<std::string> chatNames;
+    for (auto &shard: shards) {
+        std::vector<int32_t> chatIds;
+        {
+            auto stmt = shard->pool.reader().prepare(sqlQuery);
+            if (!stmt.bind(userId, rawTime)) {
+                throw std::runtime_error("sqlite3_bind_int error");
+            }
+
+            while (stmt.step() == SQLITE_ROW) {
+                chatIds.push_back(sqlite3_column_int(stmt, 0));
+            }
+        }
+
+        for (const auto &chatId: chatIds) {
+            chatNames.push_back(getChatName(chatId));
+        }
+    }
+
+    return chatNames;
 }
 
 
 auto Database::getChatName(const int chatId) -> std::string {
-    const auto sqlQuery = "SELECT Name FROM Chats WHERE Id = ?";
+    static auto &latency = operationLatency("getChatName");
+    ScopedTimer timer(latency);
 
-    std::lock_guard lockGuard(mutex);
-    if (!prepareStatement(sqlQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
+    if (auto chatName = chats.findChatName(chatId)) {
+        return *chatName;
     }
 
-    if (!bindStatement(chatId)) {
-        throw std::runtime_error("sqlite3_bind_int error");
-    }
+    const auto sqlQuery = "SELECT Name FROM Chats WHERE Id = ?";
 
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        return reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
-    } else {
-        return {};
+    std::string chatName;
+    {
+        auto stmt = pool.reader().prepare(sqlQuery);
+        if (!stmt.bind(chatId)) {
+            throw std::runtime_error("sqlite3_bind_int error");
+        }
+
+        if (stmt.step() != SQLITE_ROW) {
+            return {};
+        }
+        chatName = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
     }
+
+    chats.insertChat(chatName, chatId);
+    return chatName;
 }
 
 
-auto Database::createUser(const std::string &username, const std::string &password) -> void {
-    std::lock_guard lockGuard(mutex);
-    if (!executeSqlQuery("INSERT INTO Users(Username, Password) VALUES('" + username + "', '" + password + "');")) {
-        throw std::runtime_error("sqlite3_exec error");
+auto Database::createUser(const std::string &username, const std::string &password) -> int32_t {
+    static auto &latency = operationLatency("createUser");
+    ScopedTimer timer(latency);
+
+    const auto sqlQuery = "INSERT INTO Users(Username, Password) VALUES(?, ?);";
+
+    int32_t userId;
+    {
+        auto [lock, connection] = pool.writer();
+        auto stmt = connection.prepare(sqlQuery);
+        if (!stmt.bind(username.c_str(), password.c_str())) {
+            throw std::runtime_error("sqlite3_bind_text error");
+        }
+
+        const auto result = stmt.step();
+        if (result == SQLITE_CONSTRAINT) {
+            return -1;
+        }
+        if (result != SQLITE_DONE) {
+            throw std::runtime_error("sqlite3_step error");
+        }
+        userId = static_cast<int32_t>(sqlite3_last_insert_rowid(connection.handle()));
     }
+
+    users.insert(User(userId, username));
+    return userId;
+}
+
+
+auto Database::getUserDirectory() const -> const UserDirectory & {
+    return users;
 }
 
 
 auto Database::getUserId(const std::string &username) -> int32_t {
-    const auto sqlQuery = "SELECT Id FROM Users WHERE Username = ?";
+    static auto &latency = operationLatency("getUserId");
+    ScopedTimer timer(latency);
 
-    std::lock_guard lockGuard(mutex);
-    if (!prepareStatement(sqlQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
-    }
+    const auto sqlQuery = "SELECT Id FROM Users WHERE Username = ?";
 
-    if (!bindStatement(username.c_str())) {
+    auto stmt = pool.reader().prepare(sqlQuery);
+    if (!stmt.bind(username.c_str())) {
         throw std::runtime_error("sqlite3_bind_text error");
     }
 
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
+    if (stmt.step() == SQLITE_ROW) {
         return sqlite3_column_int(stmt, 0);
     } else {
         return -1;
@@ -365,89 +795,106 @@ auto Database::isUserExist(const std::string &username) -> bool {
 Database::Database() : Database("database.db") {}
 
 
-Database::Database(const std::string &path) {
-    if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
-        throw std::runtime_error("sqlite3_open error");
+Database::Database(
+        const std::string &path,
+        size_t shardsCount,
+        MessageStorage messageStorage
+) : pool(path) {
+    {
+        auto [lock, connection] = pool.writer();
+        migrate(connection, migrations);
+        setSetting(connection, "ShardsCount", static_cast<int64_t>(shardsCount));
+        setSetting(connection, "MessageStorage", static_cast<int64_t>(messageStorage));
     }
 
-    std::string sql = "CREATE TABLE IF NOT EXISTS Users(Id INTEGER PRIMARY KEY AUTOINCREMENT, Username TEXT, Password TEXT);"
-                      "CREATE TABLE IF NOT EXISTS Chats(Id INTEGER PRIMARY KEY AUTOINCREMENT, Name TEXT, AdminId INT, CreationRawTime INT);"
-                      "CREATE TABLE IF NOT EXISTS ChatsInfo(ChatId INT, UserId INT, AllowedRawTime INT);"
-                      "CREATE TABLE IF NOT EXISTS Messages(Id INTEGER PRIMARY KEY AUTOINCREMENT, ChatId INT, SenderId INT, RawTime INT, Time DATETIME, Data TEXT);";
-
-    if (!executeSqlQuery(sql)) {
-        throw std::runtime_error("sqlite3_exec error");
+    if (messageStorage == MessageStorage::Log) {
+        messageLog = std::make_unique<MessageLog>(getMessageLogPath(path));
     }
-}
 
+    if (shardsCount == 0) {
+        shards.push_back(std::make_unique<Shard>(pool));
+    }
+    for (size_t i = 0; i < shardsCount; i++) {
+        shards.push_back(std::make_unique<Shard>(getShardPath(path, i)));
+    }
 
-Database::~Database() {
-    if (err_msg) {
-        sqlite3_free(err_msg);
+    for (const auto &user: getAllUsers()) {
+        users.insert(user);
     }
-    sqlite3_close(db);
 }
 
+
 auto
 Database::getAllMessagesFromChat(const std::string &chatName, int32_t userId) -> std::vector<ChatMessage> {
+    static auto &latency = operationLatency("getAllMessagesFromChat");
+    ScopedTimer timer(latency);
+
     const auto chatId = getChatId(chatName);
-    const auto sqlQueryForRawTime = "SELECT AllowedRawTime FROM ChatsInfo WHERE ChatId = ? AND UserId = ?";
 
-    std::lock_guard lockGuard(mutex);
-    if (!prepareStatement(sqlQueryForRawTime)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
+    time_t allowedRawTime;
+    try {
+        allowedRawTime = getUserAllowedRawTime(chatId, userId);
+    } catch (std::runtime_error &) {
+        throw std::logic_error("Chat don't exists");
     }
 
-    if (!bindStatement(chatId, userId)) {
-        throw std::runtime_error("sqlite_bind error");
-    }
+    const auto sqlQueryForMessages = "SELECT Id, SenderId, Time, Data FROM Messages WHERE ChatId = ? AND RawTime >= ? ORDER BY RawTime";
 
-    int32_t allowedRawTime;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        allowedRawTime = sqlite3_column_int(stmt, 0);
+    std::vector<ChatMessage> messages;
+    std::vector<int32_t> senderIds;
+    if (messageLog) {
+        // log is ordered by id, which follows RawTime of appends
+        messageLog->read(chatId, allowedRawTime, 0, std::numeric_limits<int32_t>::max(), true, messages, senderIds);
     } else {
-        throw std::logic_error("Chat don't exists");
-    }
-
-    const auto sqlQueryForMessages = "SELECT SenderId, Time, Data FROM Messages WHERE ChatId = ? AND RawTime >= ? ORDER BY RawTime";
+        auto stmt = getShard(chatId).pool.reader().prepare(sqlQueryForMessages);
+        if (!stmt.bind(chatId, allowedRawTime)) {
+            throw std::runtime_error("sqlite_bind error");
+        }
 
-    if (!prepareStatement(sqlQueryForMessages)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
+        while (stmt.step() == SQLITE_ROW) {
+            messages.emplace_back(
+                    sqlite3_column_int64(stmt, 0),
+                    reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2)),
+                    std::string(),
+                    reinterpret_cast<const char *>(sqlite3_column_text(stmt, 3))
+            );
+            senderIds.push_back(sqlite3_column_int(stmt, 1));
+        }
     }
 
-    if (!bindStatement(chatId, allowedRawTime)) {
-        throw std::runtime_error("sqlite_bind error");
-    }
+    resolveSenders(messages, senderIds);
 
-    std::vector<ChatMessage> messages;
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        messages.emplace_back(
-                reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)),
-                std::to_string(sqlite3_column_int(stmt, 0)),
-                reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2))
+    return messages;
+}
 
-        );
-    }
 
-    for (auto &chatMessage: messages) {
-        chatMessage.username = getUsername(std::stoi(chatMessage.username));
+auto Database::resolveSenders(std::vector<ChatMessage> &messages, const std::vector<int32_t> &senderIds) -> void {
+    for (size_t i = 0; i < messages.size(); i++) {
+        messages[i].username = getUsername(senderIds[i]);
     }
-
-    return messages;
 }
 
+
 auto Database::getUsername(const int id) -> std::string {
+    if (auto user = users.find(id)) {
+        return user->username;
+    }
+
     const auto sqlQuery = "SELECT Username FROM Users WHERE Id = ?";
 
-    if (!prepareStatement(sqlQuery)) {
-        throw std::runtime_error("sqlite3_prepare_v2 error");
-    }
-    if (!bindStatement(id)) {
-        throw std::runtime_error("sqlite3_bind_text error");
-    }
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        return std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
-    } else {
-        throw std::runtime_error("sqlite3_step error");
+    std::string username;
+    {
+        auto stmt = pool.reader().prepare(sqlQuery);
+        if (!stmt.bind(id)) {
+            throw std::runtime_error("sqlite3_bind_text error");
+        }
+        if (stmt.step() == SQLITE_ROW) {
+            username = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+        } else {
+            throw std::runtime_error("sqlite3_step error");
+        }
     }
+
+    users.insert(User(id, username));
+    return username;
 }
@@ -0,0 +1,116 @@
+#include <stdexcept>
+
+
+#include "../groupCommit.hpp"
+
+
+GroupCommit::GroupCommit(
+        ConnectionPool &pool,
+        size_t maxBatchSize,
+        std::chrono::microseconds maxBatchDelay
+) : pool(pool), maxBatchSize(std::max<size_t>(maxBatchSize, 1)), maxBatchDelay(maxBatchDelay),
+    committer(&GroupCommit::commitLoop, this) {}
+
+
+GroupCommit::~GroupCommit() {
+    {
+        std::lock_guard lockGuard(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    committer.join();
+}
+
+
+auto GroupCommit::configure(size_t batchSize, std::chrono::microseconds batchDelay) -> void {
+    std::lock_guard lockGuard(mutex);
+    maxBatchSize = std::max<size_t>(batchSize, 1);
+    maxBatchDelay = batchDelay;
+}
+
+
+auto GroupCommit::submit(Write write) -> void {
+    std::future<void> committed;
+    {
+        std::lock_guard lockGuard(mutex);
+        if (stopping) {
+            throw std::runtime_error("group commit stopped");
+        }
+        queue.push_back({std::move(write), {}});
+        committed = queue.back().committed.get_future();
+    }
+    condition.notify_all();
+
+    committed.get();
+}
+
+
+auto GroupCommit::commitLoop() -> void {
+    while (true) {
+        std::vector<PendingWrite> batch;
+        {
+            std::unique_lock lock(mutex);
+            condition.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) {
+                return;
+            }
+
+            const auto deadline = std::chrono::steady_clock::now() + maxBatchDelay;
+            condition.wait_until(lock, deadline, [this] { return stopping || queue.size() >= maxBatchSize; });
+
+            const auto batchSize = std::min(queue.size(), maxBatchSize);
+            batch.reserve(batchSize);
+            for (size_t i = 0; i < batchSize; i++) {
+                batch.push_back(std::move(queue.front()));
+                queue.pop_front();
+            }
+        }
+
+        commit(batch);
+    }
+}
+
+
+auto GroupCommit::commit(std::vector<PendingWrite> &batch) -> void {
+    std::vector<std::exception_ptr> errors(batch.size());
+
+    try {
+        auto [lock, connection] = pool.writer();
+        if (!connection.execute("BEGIN;")) {
+            throw std::runtime_error("sqlite3_exec error");
+        }
+
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (!connection.execute("SAVEPOINT write;")) {
+                errors[i] = std::make_exception_ptr(std::runtime_error("sqlite3_exec error"));
+                continue;
+            }
+
+            try {
+                batch[i].write(connection);
+            } catch (...) {
+                errors[i] = std::current_exception();
+                connection.execute("ROLLBACK TO write;");
+            }
+            connection.execute("RELEASE write;");
+        }
+
+        if (!connection.execute("COMMIT;")) {
+            connection.execute("ROLLBACK;");
+            throw std::runtime_error("sqlite3_exec error");
+        }
+    } catch (...) {
+        for (auto &pendingWrite: batch) {
+            pendingWrite.committed.set_exception(std::current_exception());
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < batch.size(); i++) {
+        if (errors[i]) {
+            batch[i].committed.set_exception(errors[i]);
+        } else {
+            batch[i].committed.set_value();
+        }
+    }
+}
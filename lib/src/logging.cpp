@@ -0,0 +1,172 @@
+#include <ctime>
+#include <cstdio>
+#include <vector>
+#include <utility>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+
+
+#include "../logging.hpp"
+
+
+auto parseLogLevel(const std::string &name) -> LogLevel {
+    if (name == "debug") {
+        return LogLevel::Debug;
+    } else if (name == "info") {
+        return LogLevel::Info;
+    } else if (name == "warning") {
+        return LogLevel::Warning;
+    } else if (name == "error") {
+        return LogLevel::Error;
+    } else if (name == "off") {
+        return LogLevel::Off;
+    }
+    throw std::runtime_error("unknown log level " + name);
+}
+
+
+static auto getLevelName(LogLevel level) -> const char * {
+    switch (level) {
+        case LogLevel::Debug:
+            return "DEBUG";
+        case LogLevel::Info:
+            return "INFO";
+        case LogLevel::Warning:
+            return "WARNING";
+        case LogLevel::Error:
+            return "ERROR";
+        default:
+            return "";
+    }
+}
+
+
+auto Logger::ThreadBuffer::push(Record &&record) noexcept -> bool {
+    const auto currentTail = tail.load(std::memory_order_relaxed);
+    if (currentTail - head.load(std::memory_order_acquire) == capacity) {
+        return false;
+    }
+
+    records[currentTail % capacity] = std::move(record);
+    tail.store(currentTail + 1, std::memory_order_release);
+    return true;
+}
+
+
+Logger::ThreadBufferOwner::~ThreadBufferOwner() {
+    buffer->closed.store(true, std::memory_order_release);
+}
+
+
+Logger::Logger() : flusher(&Logger::runFlusher, this) {}
+
+
+auto Logger::get() -> Logger & {
+    static Logger instance;
+    return instance;
+}
+
+
+Logger::~Logger() {
+    {
+        std::lock_guard lockGuard(flusherMutex);
+        stopping = true;
+    }
+    flusherCondition.notify_one();
+    flusher.join();
+}
+
+
+auto Logger::setLevel(LogLevel newLevel) noexcept -> void {
+    level.store(newLevel, std::memory_order_relaxed);
+}
+
+
+auto Logger::getThreadBuffer() -> ThreadBuffer & {
+    thread_local ThreadBufferOwner owner{[this] {
+        auto buffer = std::make_shared<ThreadBuffer>();
+        std::lock_guard lockGuard(buffersMutex);
+        buffers.push_back(buffer);
+        return buffer;
+    }()};
+    return *owner.buffer;
+}
+
+
+auto Logger::write(LogLevel recordLevel, std::string text) noexcept -> void {
+    try {
+        if (!getThreadBuffer().push(Record{std::chrono::system_clock::now(), recordLevel, std::move(text)})) {
+            droppedCount.fetch_add(1, std::memory_order_relaxed);
+        }
+    } catch (...) {
+        droppedCount.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+
+auto Logger::drain() -> bool {
+    std::vector<std::pair<Record, std::thread::id>> drained;
+
+    {
+        std::lock_guard lockGuard(buffersMutex);
+        for (auto it = buffers.begin(); it != buffers.end();) {
+            auto &buffer = **it;
+            // closed is read before records, so records pushed before thread exited are drained
+            const auto closed = buffer.closed.load(std::memory_order_acquire);
+            const auto currentTail = buffer.tail.load(std::memory_order_acquire);
+
+            auto currentHead = buffer.head.load(std::memory_order_relaxed);
+            for (; currentHead != currentTail; currentHead++) {
+                drained.emplace_back(std::move(buffer.records[currentHead % ThreadBuffer::capacity]), buffer.threadId);
+            }
+            buffer.head.store(currentHead, std::memory_order_release);
+
+            it = closed ? buffers.erase(it) : std::next(it);
+        }
+    }
+
+    // records of different threads are interleaved by time
+    std::stable_sort(drained.begin(), drained.end(), [](const auto &lhs, const auto &rhs) {
+        return lhs.first.time < rhs.first.time;
+    });
+
+    std::ostringstream output;
+    for (const auto &[record, threadId]: drained) {
+        const auto time = std::chrono::system_clock::to_time_t(record.time);
+        const auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(
+                record.time.time_since_epoch()).count() % 1000;
+        std::tm tm{};
+        localtime_r(&time, &tm);
+
+        output << std::put_time(&tm, "%F %T") << "." << std::setw(3) << std::setfill('0') << milliseconds
+               << " " << getLevelName(record.level) << " [" << threadId << "] " << record.text << "\n";
+    }
+
+    if (const auto dropped = droppedCount.exchange(0, std::memory_order_relaxed); dropped > 0) {
+        output << dropped << " log records dropped\n";
+    }
+
+    const auto text = output.str();
+    if (text.empty()) {
+        return false;
+    }
+    std::fwrite(text.data(), 1, text.size(), stdout);
+    std::fflush(stdout);
+    return true;
+}
+
+
+auto Logger::runFlusher() -> void {
+    std::unique_lock lock(flusherMutex);
+    while (!stopping) {
+        lock.unlock();
+        drain();
+        lock.lock();
+
+        flusherCondition.wait_for(lock, flushInterval, [this] { return stopping; });
+    }
+    lock.unlock();
+
+    drain();
+}
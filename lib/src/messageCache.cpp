@@ -0,0 +1,172 @@
+#include <limits>
+#include <stdexcept>
+#include <algorithm>
+
+
+#include "../migrations.hpp"
+#include "../messageCache.hpp"
+
+
+static const Migrations migrations = {
+        // 1: initial schema
+        "CREATE TABLE Chats(Name TEXT PRIMARY KEY) WITHOUT ROWID;"
+        "CREATE TABLE Messages(ChatName TEXT, Id INTEGER, Time TEXT, Username TEXT, Data TEXT, "
+        "PRIMARY KEY(ChatName, Id)) WITHOUT ROWID;",
+
+        // 2: lower bound of cached history, chats synced before were synced from first message
+        "ALTER TABLE Chats ADD COLUMN OlderCursor INT NOT NULL DEFAULT 0;"
+};
+
+
+MessageCache::MessageCache(const std::string &path) : connection(path, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE) {
+    if (!connection.execute("PRAGMA journal_mode = WAL;") || !connection.execute("PRAGMA synchronous = NORMAL;")) {
+        throw std::runtime_error("sqlite3_exec error");
+    }
+    migrate(connection, migrations);
+}
+
+
+auto MessageCache::getChats() -> std::vector<std::string> {
+    std::lock_guard lockGuard(mutex);
+    auto stmt = connection.prepare("SELECT Name FROM Chats");
+
+    std::vector<std::string> chats;
+    while (stmt.step() == SQLITE_ROW) {
+        chats.emplace_back(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+    }
+    return chats;
+}
+
+
+auto MessageCache::insertChat(const std::string &chatName) -> void {
+    std::lock_guard lockGuard(mutex);
+    auto stmt = connection.prepare("INSERT OR IGNORE INTO Chats(Name) VALUES(?)");
+    if (!stmt.bind(chatName.c_str())) {
+        throw std::runtime_error("sqlite3_bind_text error");
+    }
+
+    if (stmt.step() != SQLITE_DONE) {
+        throw std::runtime_error("sqlite3_step error");
+    }
+}
+
+
+auto MessageCache::getLastMessageId(const std::string &chatName) -> int64_t {
+    std::lock_guard lockGuard(mutex);
+    auto stmt = connection.prepare("SELECT MAX(Id) FROM Messages WHERE ChatName = ?");
+    if (!stmt.bind(chatName.c_str())) {
+        throw std::runtime_error("sqlite3_bind_text error");
+    }
+
+    if (stmt.step() != SQLITE_ROW) {
+        throw std::runtime_error("sqlite3_step error");
+    }
+    return sqlite3_column_int64(stmt, 0);
+}
+
+
+auto MessageCache::insertMessagesInTransaction(
+        const std::string &chatName,
+        const std::vector<ChatMessage> &messages
+) -> bool {
+    const auto sqlQuery = "INSERT OR IGNORE INTO Messages(ChatName, Id, Time, Username, Data) VALUES(?, ?, ?, ?, ?)";
+
+    for (const auto &message: messages) {
+        auto stmt = connection.prepare(sqlQuery);
+        if (!stmt.bind(chatName.c_str(), message.id, message.datetime.c_str(), message.username.c_str(),
+                       message.text.c_str()) || stmt.step() != SQLITE_DONE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+auto MessageCache::commit(bool succeeded) -> void {
+    // statement is already reset, so rollback isn't blocked by it
+    if (!succeeded) {
+        connection.execute("ROLLBACK;");
+        throw std::runtime_error("sqlite3_step error");
+    }
+
+    if (!connection.execute("COMMIT;")) {
+        connection.execute("ROLLBACK;");
+        throw std::runtime_error("sqlite3_exec error");
+    }
+}
+
+
+auto MessageCache::insertMessages(const std::string &chatName, const std::vector<ChatMessage> &messages) -> void {
+    std::lock_guard lockGuard(mutex);
+    if (!connection.execute("BEGIN;")) {
+        throw std::runtime_error("sqlite3_exec error");
+    }
+    commit(insertMessagesInTransaction(chatName, messages));
+}
+
+
+auto MessageCache::getOlderCursor(const std::string &chatName) -> int64_t {
+    std::lock_guard lockGuard(mutex);
+    auto stmt = connection.prepare("SELECT OlderCursor FROM Chats WHERE Name = ?");
+    if (!stmt.bind(chatName.c_str())) {
+        throw std::runtime_error("sqlite3_bind_text error");
+    }
+
+    // chat that isn't cached has no messages cached
+    if (stmt.step() != SQLITE_ROW) {
+        return 0;
+    }
+    return sqlite3_column_int64(stmt, 0);
+}
+
+
+auto MessageCache::insertOlderMessages(
+        const std::string &chatName,
+        const std::vector<ChatMessage> &messages,
+        int64_t olderCursor
+) -> void {
+    const auto sqlQuery = "INSERT INTO Chats(Name, OlderCursor) VALUES(?, ?) "
+                          "ON CONFLICT(Name) DO UPDATE SET OlderCursor = excluded.OlderCursor";
+
+    std::lock_guard lockGuard(mutex);
+    if (!connection.execute("BEGIN;")) {
+        throw std::runtime_error("sqlite3_exec error");
+    }
+
+    auto succeeded = insertMessagesInTransaction(chatName, messages);
+    if (succeeded) {
+        auto stmt = connection.prepare(sqlQuery);
+        succeeded = stmt.bind(chatName.c_str(), olderCursor) && stmt.step() == SQLITE_DONE;
+    }
+    commit(succeeded);
+}
+
+
+auto MessageCache::getMessages(
+        const std::string &chatName,
+        int64_t beforeId,
+        int32_t limit
+) -> std::vector<ChatMessage> {
+    const auto sqlQuery = "SELECT Id, Time, Username, Data FROM Messages "
+                          "WHERE ChatName = ? AND Id < ? ORDER BY Id DESC LIMIT ?";
+
+    std::lock_guard lockGuard(mutex);
+    auto stmt = connection.prepare(sqlQuery);
+    const auto from = (beforeId > 0) ? beforeId : std::numeric_limits<int64_t>::max();
+    if (!stmt.bind(chatName.c_str(), from, limit)) {
+        throw std::runtime_error("sqlite3_bind_int error");
+    }
+
+    std::vector<ChatMessage> messages;
+    while (stmt.step() == SQLITE_ROW) {
+        messages.emplace_back(
+                sqlite3_column_int64(stmt, 0),
+                reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)),
+                reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2)),
+                reinterpret_cast<const char *>(sqlite3_column_text(stmt, 3))
+        );
+    }
+
+    std::reverse(messages.begin(), messages.end());
+    return messages;
+}
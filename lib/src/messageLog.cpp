@@ -0,0 +1,341 @@
+#include <atomic>
+#include <cstring>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <stdexcept>
+#include <filesystem>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#include "../messageLog.hpp"
+
+
+MessageLog::Segment::Segment(std::string path) : path(std::move(path)) {
+    const auto fd = open(this->path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        throw std::runtime_error("can't open " + this->path);
+    }
+
+    struct stat status{};
+    if (fstat(fd, &status) == -1) {
+        close(fd);
+        throw std::runtime_error("can't stat " + this->path);
+    }
+    size = std::min<uint64_t>(status.st_size, segmentSize);
+
+    // new file is zero filled, so its first record reads as empty
+    if (size < initialSegmentSize) {
+        if (ftruncate(fd, initialSegmentSize) == -1) {
+            close(fd);
+            throw std::runtime_error("can't resize " + this->path);
+        }
+        size = initialSegmentSize;
+    }
+
+    // mapping stays valid after file is closed
+    auto *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("can't map " + this->path);
+    }
+    data = static_cast<char *>(mapping);
+}
+
+
+MessageLog::Segment::~Segment() {
+    munmap(data, size);
+}
+
+
+auto MessageLog::Segment::grow(uint64_t minimumSize) -> void {
+    auto newSize = size;
+    while (newSize < minimumSize) {
+        newSize *= 2;
+    }
+    newSize = std::min(newSize, segmentSize);
+
+    const auto fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd == -1) {
+        throw std::runtime_error("can't open " + path);
+    }
+    const auto resized = ftruncate(fd, static_cast<off_t>(newSize)) == 0;
+    close(fd);
+    if (!resized) {
+        throw std::runtime_error("can't resize " + path);
+    }
+
+    auto *mapping = mremap(data, size, newSize, MREMAP_MAYMOVE);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("can't map " + path);
+    }
+    data = static_cast<char *>(mapping);
+    size = newSize;
+}
+
+
+MessageLog::MessageLog(std::string directory) : directory(std::move(directory)) {
+    std::filesystem::create_directories(this->directory);
+
+    lockFd = open((this->directory + "/lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lockFd == -1) {
+        throw std::runtime_error("can't open lock of " + this->directory);
+    }
+    if (flock(lockFd, LOCK_EX | LOCK_NB) == -1) {
+        close(lockFd);
+        throw std::runtime_error(this->directory + " is used by another process");
+    }
+}
+
+
+MessageLog::~MessageLog() {
+    // segments are unmapped before lock is released
+    chats.clear();
+    close(lockFd);
+}
+
+
+auto MessageLog::getSegmentPath(int32_t chatId, size_t index) const -> std::string {
+    return directory + "/chat-" + std::to_string(chatId) + "-" + std::to_string(index) + ".log";
+}
+
+
+auto MessageLog::getChatLog(int32_t chatId) -> ChatLog & {
+    {
+        std::shared_lock lock(chatsMutex);
+        if (auto it = chats.find(chatId); it != chats.end()) {
+            return *it->second;
+        }
+    }
+
+    std::lock_guard lockGuard(chatsMutex);
+    auto &chatLog = chats[chatId];
+    if (!chatLog) {
+        auto openedChatLog = std::make_unique<ChatLog>();
+        for (size_t i = 0; std::filesystem::exists(getSegmentPath(chatId, i)); i++) {
+            openedChatLog->segments.push_back(std::make_unique<Segment>(getSegmentPath(chatId, i)));
+        }
+        load(chatId, *openedChatLog);
+        chatLog = std::move(openedChatLog);
+    }
+    return *chatLog;
+}
+
+
+auto MessageLog::load(int32_t chatId, ChatLog &chatLog) const -> void {
+    Position position{};
+    while (position.segment < chatLog.segments.size()) {
+        auto &segment = *chatLog.segments[position.segment];
+        const auto state = checkRecord(segment, position.offset);
+
+        if (state == RecordState::End && position.segment + 1 < chatLog.segments.size()) {
+            position = {position.segment + 1, 0};
+            continue;
+        }
+
+        // record cut by crash of host ends log, appends overwrite it
+        if (state == RecordState::Invalid) {
+            std::memset(segment.at(position.offset), 0, segment.getSize() - position.offset);
+            const auto segmentsCount = chatLog.segments.size();
+            chatLog.segments.resize(position.segment + 1);
+            for (auto i = position.segment + 1; i < segmentsCount; i++) {
+                std::filesystem::remove(getSegmentPath(chatId, i));
+            }
+        }
+        if (state != RecordState::Valid) {
+            break;
+        }
+
+        const auto *record = getRecord(chatLog, position);
+        if (chatLog.lastId % blockSize == 0) {
+            chatLog.blocks.push_back({position, record->rawTime});
+        } else {
+            chatLog.blocks.back().maxRawTime = std::max(chatLog.blocks.back().maxRawTime, record->rawTime);
+        }
+        chatLog.lastId++;
+        position.offset += record->size;
+    }
+    chatLog.tail = position.offset;
+}
+
+
+auto MessageLog::checkRecord(const Segment &segment, uint64_t offset) noexcept -> RecordState {
+    if (offset + sizeof(RecordHeader) > segment.getSize()) {
+        return RecordState::End;
+    }
+
+    const auto *record = reinterpret_cast<const RecordHeader *>(segment.at(offset));
+    if (record->size == 0) {
+        return RecordState::End;
+    }
+
+    const auto fieldsSize = static_cast<uint64_t>(record->datetimeSize) + record->dataSize;
+    if (record->size < sizeof(RecordHeader) || record->size % 8 != 0 || offset + record->size > segment.getSize() ||
+        sizeof(RecordHeader) + fieldsSize > record->size) {
+        return RecordState::Invalid;
+    }
+    return RecordState::Valid;
+}
+
+
+auto MessageLog::next(const ChatLog &chatLog, Position position) noexcept -> Position {
+    const auto &segment = *chatLog.segments[position.segment];
+    position.offset += getRecord(chatLog, position)->size;
+    if (position.offset + sizeof(RecordHeader) > segment.getSize() || getRecord(chatLog, position)->size == 0) {
+        return {position.segment + 1, 0};
+    }
+    return position;
+}
+
+
+auto MessageLog::getRecord(const ChatLog &chatLog, Position position) noexcept -> const RecordHeader * {
+    return reinterpret_cast<const RecordHeader *>(chatLog.segments[position.segment]->at(position.offset));
+}
+
+
+auto MessageLog::readBlock(
+        const ChatLog &chatLog,
+        int64_t block,
+        int64_t firstId,
+        int64_t lastId,
+        time_t allowedRawTime,
+        std::vector<ChatMessage> &messages,
+        std::vector<int32_t> &senderIds
+) -> void {
+    const auto blockFirstId = block * blockSize + 1;
+    auto position = chatLog.blocks[block].position;
+    for (auto id = blockFirstId; id <= lastId; id++) {
+        if (id != blockFirstId) {
+            position = next(chatLog, position);
+        }
+
+        const auto *record = getRecord(chatLog, position);
+        if (id < firstId || record->rawTime < allowedRawTime) {
+            continue;
+        }
+
+        const auto *fields = reinterpret_cast<const char *>(record) + sizeof(RecordHeader);
+        messages.emplace_back(
+                id,
+                std::string(fields, record->datetimeSize),
+                std::string(),
+                std::string(fields + record->datetimeSize, record->dataSize)
+        );
+        senderIds.push_back(record->senderId);
+    }
+}
+
+
+auto MessageLog::append(
+        int32_t chatId,
+        int32_t senderId,
+        time_t rawTime,
+        const std::string &datetime,
+        const std::string &data
+) -> int64_t {
+    const auto recordSize = (sizeof(RecordHeader) + datetime.size() + data.size() + 7) / 8 * 8;
+    if (recordSize > segmentSize) {
+        throw std::runtime_error("message is too large");
+    }
+
+    auto &chatLog = getChatLog(chatId);
+    std::lock_guard lockGuard(chatLog.mutex);
+
+    if (chatLog.segments.empty() || chatLog.tail + recordSize > segmentSize) {
+        // end of full segment must read as empty record
+        if (!chatLog.segments.empty() && chatLog.tail + sizeof(RecordHeader) <= chatLog.segments.back()->getSize()) {
+            std::memset(chatLog.segments.back()->at(chatLog.tail), 0, sizeof(RecordHeader));
+        }
+        chatLog.segments.push_back(std::make_unique<Segment>(getSegmentPath(chatId, chatLog.segments.size())));
+        chatLog.tail = 0;
+    }
+
+    // readers hold shared lock of chat, so mapping can move
+    if (chatLog.tail + recordSize > chatLog.segments.back()->getSize()) {
+        chatLog.segments.back()->grow(chatLog.tail + recordSize);
+    }
+
+    const Position position{chatLog.segments.size() - 1, chatLog.tail};
+    auto *destination = chatLog.segments.back()->at(chatLog.tail);
+    auto *header = reinterpret_cast<RecordHeader *>(destination);
+
+    std::memcpy(destination + sizeof(RecordHeader), datetime.data(), datetime.size());
+    std::memcpy(destination + sizeof(RecordHeader) + datetime.size(), data.data(), data.size());
+    header->senderId = senderId;
+    header->rawTime = rawTime;
+    header->datetimeSize = static_cast<uint32_t>(datetime.size());
+    header->dataSize = static_cast<uint32_t>(data.size());
+    std::atomic_ref<uint32_t>(header->size).store(static_cast<uint32_t>(recordSize), std::memory_order_release);
+
+    const auto id = ++chatLog.lastId;
+    if ((id - 1) % blockSize == 0) {
+        chatLog.blocks.push_back({position, rawTime});
+    } else {
+        chatLog.blocks.back().maxRawTime = std::max<int64_t>(chatLog.blocks.back().maxRawTime, rawTime);
+    }
+    chatLog.tail += recordSize;
+
+    return id;
+}
+
+
+auto MessageLog::read(
+        int32_t chatId,
+        time_t allowedRawTime,
+        int64_t cursor,
+        int32_t limit,
+        bool forward,
+        std::vector<ChatMessage> &messages,
+        std::vector<int32_t> &senderIds
+) -> void {
+    messages.clear();
+    senderIds.clear();
+
+    auto &chatLog = getChatLog(chatId);
+    std::shared_lock lock(chatLog.mutex);
+
+    const auto pageLimit = static_cast<size_t>(std::max(limit, 0));
+    const auto blocksCount = static_cast<int64_t>(chatLog.blocks.size());
+
+    if (forward) {
+        const auto firstId = std::max<int64_t>(cursor, 0) + 1;
+        for (auto block = (firstId - 1) / blockSize; block < blocksCount && messages.size() < pageLimit; block++) {
+            if (chatLog.blocks[block].maxRawTime < allowedRawTime) {
+                continue;
+            }
+            const auto lastId = std::min((block + 1) * blockSize, chatLog.lastId);
+            readBlock(chatLog, block, firstId, lastId, allowedRawTime, messages, senderIds);
+        }
+
+        messages.resize(std::min(messages.size(), pageLimit));
+        senderIds.resize(messages.size());
+        return;
+    }
+
+    const auto lastId = (cursor > 0) ? std::min(cursor - 1, chatLog.lastId) : chatLog.lastId;
+
+    // blocks are read newest first, so page is collected newest first and reversed
+    std::vector<ChatMessage> blockMessages;
+    std::vector<int32_t> blockSenderIds;
+    for (auto block = (lastId - 1) / blockSize; lastId > 0 && block >= 0 && messages.size() < pageLimit; block--) {
+        if (chatLog.blocks[block].maxRawTime < allowedRawTime) {
+            continue;
+        }
+
+        blockMessages.clear();
+        blockSenderIds.clear();
+        readBlock(chatLog, block, block * blockSize + 1, std::min((block + 1) * blockSize, lastId), allowedRawTime,
+                  blockMessages, blockSenderIds);
+
+        for (auto i = blockMessages.size(); i-- > 0 && messages.size() < pageLimit;) {
+            messages.push_back(std::move(blockMessages[i]));
+            senderIds.push_back(blockSenderIds[i]);
+        }
+    }
+
+    std::reverse(messages.begin(), messages.end());
+    std::reverse(senderIds.begin(), senderIds.end());
+}
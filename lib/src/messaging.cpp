@@ -1,28 +1,325 @@
+#include <bit>
+#include <memory>
+#include <vector>
+#include <cstdlib>
+#include <zstd.h>
+
+
 #include "../messaging.hpp"
 
 
-auto sendMessage(zmqpp::socket &socket, const Message &message) -> void {
-    zmqpp::message zmqMessage;
+// strings and binaries of unpacked object point into received frame instead of being copied into zone
+static auto referenceFrame(msgpack::type::object_type, std::size_t, void *) -> bool {
+    return true;
+}
+
+
+static auto freePackage(void *data, void *) -> void {
+    std::free(data);
+}
+
+
+// first byte of compact frame, legacy frame always starts with fixarray marker of Message
+constexpr uint8_t compactProtocolVersion = 2;
+
+// first byte of compressed frame, followed by zstd frame of compact frame
+constexpr uint8_t compressedProtocolVersion = 3;
+
+// smaller frames are sent raw, compressing them costs more than it saves
+constexpr size_t compressionThreshold = 1024;
+
+// decompressed frame size limit, so malformed frame can't make receiver allocate arbitrary amount
+constexpr size_t maxDecompressedSize = 256 * 1024 * 1024;
+
+constexpr int compressionLevel = 3;
+
+// first chunk of unpack zone, the only one clear keeps, so objects of typical message fit without allocation
+constexpr size_t unpackZoneChunkSize = 64 * 1024;
+
+
+// bits of compact fields mask, fields follow in order of bits; new fields are only appended,
+// so unknown trailing fields of newer peer are skipped
+constexpr uint32_t authenticationStatusField = 1u << 0;
+constexpr uint32_t timeField = 1u << 1;
+constexpr uint32_t nameField = 1u << 2;
+constexpr uint32_t bufferField = 1u << 3;
+constexpr uint32_t flagField = 1u << 4;
+constexpr uint32_t vectorField = 1u << 5;
+constexpr uint32_t chatMessagesField = 1u << 6;
+constexpr uint32_t cursorField = 1u << 7;
+constexpr uint32_t limitField = 1u << 8;
+constexpr uint32_t compressionField = 1u << 9;
+constexpr uint32_t requestIdField = 1u << 10;
+constexpr uint32_t batchField = 1u << 11;
+
+
+static auto getCompactFields(const Message &message) -> uint32_t {
+    const auto &data = message.data;
+
+    uint32_t fields = 0;
+    fields |= (message.authenticationStatus != AuthenticationStatus{}) ? authenticationStatusField : 0;
+    fields |= (data.time != 0) ? timeField : 0;
+    fields |= (!data.name.empty()) ? nameField : 0;
+    fields |= (!data.buffer.empty()) ? bufferField : 0;
+    fields |= (data.flag) ? flagField : 0;
+    fields |= (!data.vector.empty()) ? vectorField : 0;
+    fields |= (!data.chatMessages.empty()) ? chatMessagesField : 0;
+    fields |= (data.cursor != 0) ? cursorField : 0;
+    fields |= (data.limit != 0) ? limitField : 0;
+    fields |= (message.compression != Compression{}) ? compressionField : 0;
+    fields |= (message.requestId != 0) ? requestIdField : 0;
+    fields |= (!message.batch.empty()) ? batchField : 0;
+    return fields;
+}
+
+
+// [type, fields mask, present fields...]
+static auto packCompactFields(msgpack::packer<msgpack::sbuffer> &packer, const Message &message) -> void {
+    const auto &data = message.data;
+    const auto fields = getCompactFields(message);
+
+    packer.pack_array(2 + std::popcount(fields));
+    packer.pack(message.type);
+    packer.pack(fields);
+
+    if (fields & authenticationStatusField) {
+        packer.pack(message.authenticationStatus);
+    }
+    if (fields & timeField) {
+        packer.pack(data.time);
+    }
+    if (fields & nameField) {
+        packer.pack(data.name);
+    }
+    if (fields & bufferField) {
+        packer.pack(data.buffer);
+    }
+    if (fields & flagField) {
+        packer.pack(data.flag);
+    }
+    if (fields & vectorField) {
+        packer.pack(data.vector);
+    }
+    if (fields & chatMessagesField) {
+        packer.pack(data.chatMessages);
+    }
+    if (fields & cursorField) {
+        packer.pack(data.cursor);
+    }
+    if (fields & limitField) {
+        packer.pack(data.limit);
+    }
+    if (fields & compressionField) {
+        packer.pack(message.compression);
+    }
+    if (fields & requestIdField) {
+        packer.pack(message.requestId);
+    }
+    if (fields & batchField) {
+        packer.pack_array(message.batch.size());
+        for (const auto &subMessage: message.batch) {
+            packCompactFields(packer, subMessage);
+        }
+    }
+}
+
+
+static auto packCompact(msgpack::sbuffer &package, const Message &message) -> void {
+    msgpack::packer<msgpack::sbuffer> packer(package);
+    packer.pack(compactProtocolVersion);
+    packCompactFields(packer, message);
+}
+
+
+// sub-messages of batch can't carry batch themselves, so nesting depth of malformed frame is bounded
+static auto unpackCompact(const msgpack::object &object, Message &message, bool isBatchAllowed = true) -> void {
+    if (object.type != msgpack::type::ARRAY || object.via.array.size < 2) {
+        throw msgpack::type_error();
+    }
+
+    const auto *field = object.via.array.ptr;
+    const auto *end = field + object.via.array.size;
+    auto next = [&field, end]() -> const msgpack::object & {
+        if (field == end) {
+            throw msgpack::type_error();
+        }
+        return *field++;
+    };
+
+    message.authenticationStatus = {};
+    message.compression = {};
+    message.requestId = {};
+    message.batch = {};
+    message.data = {};
+    next().convert(message.type);
+    const auto fields = next().as<uint32_t>();
+
+    auto &data = message.data;
+    if (fields & authenticationStatusField) {
+        next().convert(message.authenticationStatus);
+    }
+    if (fields & timeField) {
+        next().convert(data.time);
+    }
+    if (fields & nameField) {
+        next().convert(data.name);
+    }
+    if (fields & bufferField) {
+        next().convert(data.buffer);
+    }
+    if (fields & flagField) {
+        next().convert(data.flag);
+    }
+    if (fields & vectorField) {
+        next().convert(data.vector);
+    }
+    if (fields & chatMessagesField) {
+        next().convert(data.chatMessages);
+    }
+    if (fields & cursorField) {
+        next().convert(data.cursor);
+    }
+    if (fields & limitField) {
+        next().convert(data.limit);
+    }
+    if (fields & compressionField) {
+        next().convert(message.compression);
+    }
+    if (fields & requestIdField) {
+        next().convert(message.requestId);
+    }
+    if (fields & batchField) {
+        const auto &batch = next();
+        if (!isBatchAllowed || batch.type != msgpack::type::ARRAY) {
+            throw msgpack::type_error();
+        }
+
+        message.batch.resize(batch.via.array.size);
+        for (size_t i = 0; i < message.batch.size(); i++) {
+            unpackCompact(batch.via.array.ptr[i], message.batch[i], false);
+            message.batch[i].format = WireFormat::Compact;
+        }
+    }
+}
+
+
+// returns malloc allocated compressed frame, or nullptr if compression doesn't make it smaller
+static auto compress(const char *data, size_t size, size_t &compressedSize) -> char * {
+    thread_local std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> context(ZSTD_createCCtx(), ZSTD_freeCCtx);
+
+    const auto capacity = 1 + ZSTD_compressBound(size);
+    auto *compressed = static_cast<char *>(std::malloc(capacity));
+    if (!compressed) {
+        throw std::bad_alloc();
+    }
+
+    compressed[0] = static_cast<char>(compressedProtocolVersion);
+    const auto result = ZSTD_compressCCtx(context.get(), compressed + 1, capacity - 1, data, size, compressionLevel);
+    if (ZSTD_isError(result) || 1 + result >= size) {
+        std::free(compressed);
+        return nullptr;
+    }
+
+    compressedSize = 1 + result;
+    return compressed;
+}
+
+
+// decompresses frame without leading version byte into reused thread buffer
+static auto decompress(const char *data, size_t size) -> const std::vector<char> & {
+    thread_local std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> context(ZSTD_createDCtx(), ZSTD_freeDCtx);
+    thread_local std::vector<char> buffer;
+
+    const auto decompressedSize = ZSTD_getFrameContentSize(data, size);
+    if (decompressedSize == ZSTD_CONTENTSIZE_UNKNOWN || decompressedSize == ZSTD_CONTENTSIZE_ERROR ||
+        decompressedSize > maxDecompressedSize) {
+        throw std::runtime_error("invalid compressed message");
+    }
+
+    buffer.resize(decompressedSize);
+    const auto result = ZSTD_decompressDCtx(context.get(), buffer.data(), buffer.size(), data, size);
+    if (ZSTD_isError(result) || result != decompressedSize) {
+        throw std::runtime_error("invalid compressed message");
+    }
+    return buffer;
+}
+
+
+static auto packMessage(zmqpp::message &zmqMessage, const Message &message) -> void {
     msgpack::sbuffer package;
 
-    msgpack::pack(&package, message);
-    zmqMessage.add_raw(package.data(), package.size());
+    if (message.format == WireFormat::Compact) {
+        packCompact(package, message);
+    } else {
+        msgpack::pack(&package, message);
+    }
+
+    if (message.format == WireFormat::Compact && message.compression == Compression::Zstd &&
+        package.size() > compressionThreshold) {
+        size_t compressedSize;
+        if (auto *compressed = compress(package.data(), package.size(), compressedSize)) {
+            zmqMessage.add_nocopy(compressed, compressedSize, freePackage);
+            return;
+        }
+    }
+
+    // zmq takes ownership of packed buffer and frees it after sending, so it isn't copied into frame
+    const auto size = package.size();
+    zmqMessage.add_nocopy(package.release(), size, freePackage);
+}
+
+
+static auto unpackMessage(const zmqpp::message &zmqMessage, size_t part, Message &message) -> void {
+    // reused between messages of thread; clear frees every chunk but first one, so only objects of message larger
+    // than unpackZoneChunkSize are allocated on every unpack
+    thread_local msgpack::zone zone(unpackZoneChunkSize);
+    zone.clear();
+
+    const auto *data = static_cast<const char *>(zmqMessage.raw_data(part));
+    auto size = zmqMessage.size(part);
+
+    if (size > 0 && static_cast<uint8_t>(data[0]) == compressedProtocolVersion) {
+        const auto &decompressed = decompress(data + 1, size - 1);
+        data = decompressed.data();
+        size = decompressed.size();
+    }
+
+    const auto isCompact = size > 0 && static_cast<uint8_t>(data[0]) == compactProtocolVersion;
+
+    std::size_t offset = isCompact ? 1 : 0;
+    bool referenced;
+    const auto object = msgpack::unpack(zone, data, size, offset, referenced, referenceFrame);
+
+    if (isCompact) {
+        unpackCompact(object, message);
+        message.format = WireFormat::Compact;
+    } else {
+        object.convert(message);
+        message.format = WireFormat::Legacy;
+    }
+}
+
+
+auto sendMessage(zmqpp::socket &socket, const Message &message) -> size_t {
+    zmqpp::message zmqMessage;
+    packMessage(zmqMessage, message);
+    const auto size = zmqMessage.size(0);
 
     if (!socket.send(zmqMessage)) {
         throw std::runtime_error("send timeout");
     }
+    return size;
 }
 
 
-auto receiveMessage(zmqpp::socket &socket, Message &message) -> void {
+auto receiveMessage(zmqpp::socket &socket, Message &message) -> size_t {
     zmqpp::message zmqMessage;
     if (!socket.receive(zmqMessage)) {
         throw std::runtime_error("receive timeout");
     }
 
-    msgpack::unpacked unpackedPackage;
-    msgpack::unpack(unpackedPackage, static_cast<const char *>(zmqMessage.raw_data()), zmqMessage.size(0));
-    unpackedPackage.get().convert(message);
+    unpackMessage(zmqMessage, 0, message);
+    return zmqMessage.size(0);
 }
 
 
@@ -31,3 +328,101 @@ auto receiveMessage(zmqpp::socket &socket) -> Message {
     receiveMessage(socket, message);
     return message;
 }
+
+
+auto getMessageTypeName(MessageType type) -> std::string {
+    switch (type) {
+        case MessageType::CreateMessage:
+            return "CreateMessage";
+        case MessageType::Update:
+            return "Update";
+        case MessageType::SignIn:
+            return "SignIn";
+        case MessageType::SignUp:
+            return "SignUp";
+        case MessageType::CreateChat:
+            return "CreateChat";
+        case MessageType::UpdateChats:
+            return "UpdateChats";
+        case MessageType::GetAllMessagesFromChat:
+            return "GetAllMessagesFromChat";
+        case MessageType::InviteUserToChat:
+            return "InviteUserToChat";
+        case MessageType::ClientError:
+            return "ClientError";
+        case MessageType::ServerError:
+            return "ServerError";
+        case MessageType::ChatAdded:
+            return "ChatAdded";
+        case MessageType::NewMessage:
+            return "NewMessage";
+        case MessageType::GetMessagesPage:
+            return "GetMessagesPage";
+        case MessageType::Stats:
+            return "Stats";
+        case MessageType::Resume:
+            return "Resume";
+        case MessageType::Batch:
+            return "Batch";
+        case MessageType::ChatInvalidated:
+            return "ChatInvalidated";
+    }
+    return std::to_string(static_cast<int>(type));
+}
+
+
+auto isKnownMessageType(MessageType type) -> bool {
+    return static_cast<int>(type) >= static_cast<int>(MessageType::CreateMessage) &&
+           static_cast<int>(type) <= static_cast<int>(MessageType::ChatInvalidated);
+}
+
+
+auto userTopic(const std::string &username) -> std::string {
+    return "user " + username + "\n";
+}
+
+
+auto chatTopic(const std::string &chatName) -> std::string {
+    return "chat " + chatName + "\n";
+}
+
+
+auto invalidationTopic() -> std::string {
+    return "invalidation\n";
+}
+
+
+auto sendMessage(zmqpp::socket &socket, const Envelope &envelope, const Message &message) -> size_t {
+    zmqpp::message zmqMessage;
+    for (const auto &frame: envelope) {
+        zmqMessage << frame;
+    }
+    packMessage(zmqMessage, message);
+    const auto size = zmqMessage.size(envelope.size());
+
+    if (!socket.send(zmqMessage)) {
+        throw std::runtime_error("send timeout");
+    }
+    return size;
+}
+
+
+auto receiveMessage(zmqpp::socket &socket, Envelope &envelope, Message &message) -> size_t {
+    zmqpp::message zmqMessage;
+    if (!socket.receive(zmqMessage)) {
+        throw std::runtime_error("receive timeout");
+    }
+
+    if (zmqMessage.parts() == 0) {
+        throw std::runtime_error("empty message");
+    }
+
+    const auto payloadPart = zmqMessage.parts() - 1;
+    envelope.clear();
+    for (size_t part = 0; part < payloadPart; part++) {
+        envelope.push_back(zmqMessage.get(part));
+    }
+
+    unpackMessage(zmqMessage, payloadPart, message);
+    return zmqMessage.size(payloadPart);
+}
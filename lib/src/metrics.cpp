@@ -0,0 +1,105 @@
+#include <bit>
+#include <algorithm>
+#include <sstream>
+
+
+#include "../metrics.hpp"
+
+
+auto Histogram::observe(std::chrono::nanoseconds duration) noexcept -> void {
+    const auto nanoseconds = static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0));
+
+    // bucket i holds observations up to 2^i us
+    const auto microseconds = (nanoseconds + 999) / 1000;
+    const auto bucket = std::min<size_t>(microseconds <= 1 ? 0 : std::bit_width(microseconds - 1), bucketsCount);
+
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    sumNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+}
+
+
+auto Metrics::get() -> Metrics & {
+    static Metrics instance;
+    return instance;
+}
+
+
+auto Metrics::counter(const std::string &name, const std::string &help, const std::string &labels) -> Counter & {
+    std::lock_guard lockGuard(mutex);
+    auto &family = counters[name];
+    family.help = help;
+
+    auto &counter = family.series[labels];
+    if (!counter) {
+        counter = std::make_unique<Counter>();
+    }
+    return *counter;
+}
+
+
+auto Metrics::histogram(const std::string &name, const std::string &help, const std::string &labels) -> Histogram & {
+    std::lock_guard lockGuard(mutex);
+    auto &family = histograms[name];
+    family.help = help;
+
+    auto &histogram = family.series[labels];
+    if (!histogram) {
+        histogram = std::make_unique<Histogram>();
+    }
+    return *histogram;
+}
+
+
+auto Metrics::gauge(const std::string &name, const std::string &help, std::function<double()> read) -> void {
+    std::lock_guard lockGuard(mutex);
+    gauges[name] = Gauge{help, std::move(read)};
+}
+
+
+static auto withLabels(const std::string &name, const std::string &labels) -> std::string {
+    return labels.empty() ? name : name + "{" + labels + "}";
+}
+
+
+static auto withLabels(const std::string &name, const std::string &labels, const std::string &extraLabel) -> std::string {
+    return name + "{" + (labels.empty() ? extraLabel : labels + "," + extraLabel) + "}";
+}
+
+
+auto Metrics::render() -> std::string {
+    std::ostringstream output;
+
+    std::lock_guard lockGuard(mutex);
+    for (const auto &[name, family]: counters) {
+        output << "# HELP " << name << " " << family.help << "\n# TYPE " << name << " counter\n";
+        for (const auto &[labels, counter]: family.series) {
+            output << withLabels(name, labels) << " " << counter->get() << "\n";
+        }
+    }
+
+    for (const auto &[name, gauge]: gauges) {
+        output << "# HELP " << name << " " << gauge.help << "\n# TYPE " << name << " gauge\n";
+        output << name << " " << gauge.read() << "\n";
+    }
+
+    for (const auto &[name, family]: histograms) {
+        output << "# HELP " << name << " " << family.help << "\n# TYPE " << name << " histogram\n";
+        for (const auto &[labels, histogram]: family.series) {
+            uint64_t cumulative = 0;
+            for (size_t bucket = 0; bucket < Histogram::bucketsCount; bucket++) {
+                cumulative += histogram->buckets[bucket].load(std::memory_order_relaxed);
+                const auto bound = static_cast<double>(uint64_t{1} << bucket) / 1e6;
+                output << withLabels(name + "_bucket", labels, "le=\"" + std::to_string(bound) + "\"") << " "
+                       << cumulative << "\n";
+            }
+            cumulative += histogram->buckets[Histogram::bucketsCount].load(std::memory_order_relaxed);
+            output << withLabels(name + "_bucket", labels, "le=\"+Inf\"") << " " << cumulative << "\n";
+
+            output << withLabels(name + "_sum", labels) << " "
+                   << static_cast<double>(histogram->sumNanoseconds.load(std::memory_order_relaxed)) / 1e9 << "\n";
+            output << withLabels(name + "_count", labels) << " " << cumulative << "\n";
+        }
+    }
+
+    return output.str();
+}
@@ -0,0 +1,33 @@
+#include <string>
+#include <stdexcept>
+
+
+#include "../migrations.hpp"
+
+
+static auto getSchemaVersion(Connection &connection) -> int32_t {
+    auto stmt = connection.prepare("PRAGMA user_version;");
+    if (stmt.step() != SQLITE_ROW) {
+        throw std::runtime_error("sqlite3_step error");
+    }
+    return sqlite3_column_int(stmt, 0);
+}
+
+
+auto migrate(Connection &connection, const Migrations &migrations) -> void {
+    const auto schemaVersion = getSchemaVersion(connection);
+    if (schemaVersion > static_cast<int32_t>(migrations.size())) {
+        throw std::runtime_error("database schema is newer than this build");
+    }
+
+    for (auto version = schemaVersion; version < static_cast<int32_t>(migrations.size()); version++) {
+        const auto sql = std::string("BEGIN;") + migrations[version] +
+                         "PRAGMA user_version = " + std::to_string(version + 1) + ";"
+                         "COMMIT;";
+
+        if (!connection.execute(sql)) {
+            connection.execute("ROLLBACK;");
+            throw std::runtime_error("migration to schema version " + std::to_string(version + 1) + " failed");
+        }
+    }
+}
@@ -1,4 +1,5 @@
 #include <netdb.h>
+#include <cstdlib>
 #include <unistd.h>
 #include <stdexcept>
 #include <arpa/inet.h>
@@ -29,3 +30,9 @@ auto getIP() -> std::string {
     std::string result(ipBuffer);
     return result;
 }
+
+
+auto getEndPoint(const char *variable, const std::string &defaultEndPoint) -> std::string {
+    const auto *endPoint = std::getenv(variable);
+    return endPoint ? endPoint : defaultEndPoint;
+}
@@ -0,0 +1,92 @@
+#include <stdexcept>
+
+
+#include "../publisher.hpp"
+
+
+Publisher::Publisher(zmqpp::context &context, size_t capacity, int subscriberCapacity)
+        : socket(context, zmqpp::socket_type::publish), capacity(capacity),
+          dropped(Metrics::get().counter("cp_publish_dropped_total", "Messages dropped by full publisher queue")) {
+    socket.set(zmqpp::socket_option::send_high_water_mark, subscriberCapacity);
+}
+
+
+Publisher::~Publisher() {
+    {
+        std::lock_guard lockGuard(mutex);
+        stopping = true;
+    }
+    condition.notify_one();
+
+    if (publisherThread.joinable()) {
+        publisherThread.join();
+    }
+}
+
+
+auto Publisher::bind(const std::string &endPoint) -> void {
+    if (publisherThread.joinable()) {
+        throw std::runtime_error("publisher is already started");
+    }
+    socket.bind(endPoint);
+    start();
+}
+
+
+auto Publisher::connect(const std::string &endPoint) -> void {
+    if (publisherThread.joinable()) {
+        throw std::runtime_error("publisher is already started");
+    }
+    socket.connect(endPoint);
+    start();
+}
+
+
+auto Publisher::start() -> void {
+    // socket is used only by publisher thread from now on
+    publisherThread = std::thread(&Publisher::publishLoop, this);
+}
+
+
+auto Publisher::publishLoop() noexcept -> void {
+    std::deque<std::pair<std::string, Message>> batch;
+    while (true) {
+        {
+            std::unique_lock lock(mutex);
+            condition.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (stopping) {
+                return;
+            }
+            batch.swap(queue);
+        }
+
+        for (auto &[topic, message]: batch) {
+            try {
+                sendMessage(socket, Envelope{std::move(topic)}, message);
+            } catch (std::exception &) {
+                // PUB socket doesn't block, send fails only on closed context
+                dropped.add();
+            }
+        }
+        batch.clear();
+    }
+}
+
+
+auto Publisher::publish(std::string topic, Message message) -> void {
+    {
+        std::lock_guard lockGuard(mutex);
+        if (queue.size() >= capacity) {
+            dropped.add();
+            return;
+        }
+        queue.emplace_back(std::move(topic), std::move(message));
+    }
+    condition.notify_one();
+}
+
+
+auto Publisher::size() -> size_t {
+    std::lock_guard lockGuard(mutex);
+    return queue.size();
+}
@@ -0,0 +1,108 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <fstream>
+#include <stdexcept>
+#include <filesystem>
+
+
+#include "../sessionTokens.hpp"
+
+
+// token is user id, expiry time in seconds since epoch and username followed by signature of all of them
+constexpr size_t tokenHeaderSize = sizeof(int32_t) + sizeof(int64_t);
+
+
+static auto readKey(const std::string &keyPath, unsigned char *key, size_t size) -> void {
+    std::ifstream keyFile(keyPath, std::ios::binary);
+    if (!keyFile.read(reinterpret_cast<char *>(key), static_cast<std::streamsize>(size))) {
+        throw std::runtime_error("invalid session key file " + keyPath);
+    }
+}
+
+
+SessionTokens::SessionTokens(const std::string &keyPath, std::chrono::seconds lifetime) : lifetime(lifetime) {
+    if (sodium_init() < 0) {
+        throw std::runtime_error("sodium_init error");
+    }
+
+    if (std::filesystem::exists(keyPath)) {
+        readKey(keyPath, key.data(), key.size());
+        return;
+    }
+
+    crypto_auth_keygen(key.data());
+
+    // key is written to private file of process and linked into place, so it's never readable by other users
+    // and servers starting together never read partially written key
+    const auto temporaryPath = keyPath + "." + std::to_string(getpid()) + ".tmp";
+    const auto fd = open(temporaryPath.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        throw std::runtime_error("can't create session key file " + temporaryPath);
+    }
+    const auto written = write(fd, key.data(), key.size());
+    const auto synced = fsync(fd) == 0;
+    close(fd);
+    if (written != static_cast<ssize_t>(key.size()) || !synced) {
+        unlink(temporaryPath.c_str());
+        throw std::runtime_error("session key file write error " + temporaryPath);
+    }
+
+    const auto linked = link(temporaryPath.c_str(), keyPath.c_str()) == 0;
+    const auto linkError = errno;
+    unlink(temporaryPath.c_str());
+    if (linked) {
+        return;
+    }
+    if (linkError != EEXIST) {
+        throw std::runtime_error("can't create session key file " + keyPath);
+    }
+
+    // another server created key first, every server has to sign with same one
+    readKey(keyPath, key.data(), key.size());
+}
+
+
+auto SessionTokens::issue(const User &user) const -> std::string {
+    const int64_t expiry = std::chrono::duration_cast<std::chrono::seconds>(
+            (std::chrono::system_clock::now() + lifetime).time_since_epoch()).count();
+
+    std::string token(tokenHeaderSize, '\0');
+    std::memcpy(token.data(), &user.id, sizeof(user.id));
+    std::memcpy(token.data() + sizeof(user.id), &expiry, sizeof(expiry));
+    token += user.username;
+
+    std::array<unsigned char, crypto_auth_BYTES> signature{};
+    crypto_auth(signature.data(), reinterpret_cast<const unsigned char *>(token.data()), token.size(), key.data());
+    token.append(reinterpret_cast<const char *>(signature.data()), signature.size());
+
+    return token;
+}
+
+
+auto SessionTokens::verify(const std::string &token) const -> std::optional<User> {
+    if (token.size() < tokenHeaderSize + crypto_auth_BYTES) {
+        return std::nullopt;
+    }
+
+    const auto signedSize = token.size() - crypto_auth_BYTES;
+    const auto *data = reinterpret_cast<const unsigned char *>(token.data());
+    if (crypto_auth_verify(data + signedSize, data, signedSize, key.data()) != 0) {
+        return std::nullopt;
+    }
+
+    User user;
+    int64_t expiry;
+    std::memcpy(&user.id, token.data(), sizeof(user.id));
+    std::memcpy(&expiry, token.data() + sizeof(user.id), sizeof(expiry));
+
+    const auto now = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    if (expiry < now) {
+        return std::nullopt;
+    }
+
+    user.username = token.substr(tokenHeaderSize, signedSize - tokenHeaderSize);
+    return user;
+}
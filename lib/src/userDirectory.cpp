@@ -0,0 +1,40 @@
+#include <mutex>
+
+
+#include "../userDirectory.hpp"
+
+
+auto UserDirectory::insert(const User &user) -> bool {
+    {
+        auto &shard = getShard(byUsername, user.username);
+        std::lock_guard lockGuard(shard.mutex);
+        if (!shard.users.emplace(user.username, user).second) {
+            return false;
+        }
+    }
+
+    auto &shard = getShard(byId, user.id);
+    std::lock_guard lockGuard(shard.mutex);
+    shard.users.insert_or_assign(user.id, user);
+    return true;
+}
+
+
+auto UserDirectory::find(const std::string &username) const -> std::optional<User> {
+    const auto &shard = getShard(byUsername, username);
+    std::shared_lock lock(shard.mutex);
+    if (auto it = shard.users.find(username); it != shard.users.end()) {
+        return it->second;
+    }
+    return std::nullopt;
+}
+
+
+auto UserDirectory::find(int32_t id) const -> std::optional<User> {
+    const auto &shard = getShard(byId, id);
+    std::shared_lock lock(shard.mutex);
+    if (auto it = shard.users.find(id); it != shard.users.end()) {
+        return it->second;
+    }
+    return std::nullopt;
+}
@@ -0,0 +1,51 @@
+#ifndef CP_USER_DIRECTORY_HPP
+#define CP_USER_DIRECTORY_HPP
+
+
+#include <array>
+#include <string>
+#include <cstdint>
+#include <optional>
+#include <functional>
+#include <shared_mutex>
+#include <unordered_map>
+
+
+#include "user.hpp"
+
+
+// Thread-safe, users indexed by username and by id, each index is split into shards
+// with own reader-writer lock, so lookups don't contend with each other or with sign ups
+class UserDirectory {
+    static constexpr size_t shardsCount = 16;
+
+    template<class Key>
+    struct Shard {
+        mutable std::shared_mutex mutex{};
+        std::unordered_map<Key, User> users{};
+    };
+
+    std::array<Shard<std::string>, shardsCount> byUsername{};
+    std::array<Shard<int32_t>, shardsCount> byId{};
+
+    template<class Key>
+    static auto getShard(std::array<Shard<Key>, shardsCount> &shards, const Key &key) -> Shard<Key> & {
+        return shards[std::hash<Key>{}(key) % shardsCount];
+    }
+
+    template<class Key>
+    static auto getShard(const std::array<Shard<Key>, shardsCount> &shards, const Key &key) -> const Shard<Key> & {
+        return shards[std::hash<Key>{}(key) % shardsCount];
+    }
+
+public:
+    // returns false if username is taken
+    auto insert(const User &user) -> bool;
+
+    auto find(const std::string &username) const -> std::optional<User>;
+
+    auto find(int32_t id) const -> std::optional<User>;
+};
+
+
+#endif //CP_USER_DIRECTORY_HPP
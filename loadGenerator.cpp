@@ -0,0 +1,349 @@
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <iomanip>
+#include <utility>
+#include <iostream>
+#include <algorithm>
+#include <zmqpp/zmqpp.hpp>
+
+
+#include "lib/messaging.hpp"
+
+
+// usage: loadGenerator [--host=127.0.0.1] [--sessions=10] [--requests=1000] [--legacy]
+//                      [--mix=createChat:1,createMessage:10,updateChats:5,getAllMessagesFromChat:2,signUp:0]
+//
+// server has to listen on the same host, e.g. server 4 256 0 127.0.0.1 for loopback
+//
+// every session signs up its own user and creates its own chat, then sends requests in given mix
+// and reports throughput and latency percentiles per MessageType;
+// signUp in mix signs up fresh user on second router connection, so it isn't combined with --legacy
+
+
+constexpr int32_t sendTimeout = 10 * 1000;
+constexpr int32_t receiveTimeout = 10 * 1000;
+
+constexpr int32_t pullPort = 4506;
+constexpr int32_t routerPort = 4507;
+
+
+struct Options {
+    std::string host{"127.0.0.1"};
+    size_t sessions{10};
+    size_t requests{1000};
+    // connect through push-connect handshake served by clientMonitor threads instead of router workers
+    bool legacy{};
+    std::vector<std::pair<MessageType, uint32_t>> mix{
+            {MessageType::CreateChat,             1},
+            {MessageType::CreateMessage,          10},
+            {MessageType::UpdateChats,            5},
+            {MessageType::GetAllMessagesFromChat, 2}
+    };
+};
+
+
+struct Samples {
+    std::map<MessageType, std::vector<std::chrono::nanoseconds>> latencies{};
+    std::map<MessageType, size_t> errors{};
+
+    auto merge(Samples &other) -> void {
+        for (auto &[type, latency]: other.latencies) {
+            auto &merged = latencies[type];
+            merged.insert(merged.end(), latency.begin(), latency.end());
+        }
+        for (const auto &[type, count]: other.errors) {
+            errors[type] += count;
+        }
+    }
+};
+
+
+auto parseMix(const std::string &value) -> std::vector<std::pair<MessageType, uint32_t>> {
+    const std::map<std::string, MessageType> types{
+            {"createChat",             MessageType::CreateChat},
+            {"createMessage",          MessageType::CreateMessage},
+            {"updateChats",            MessageType::UpdateChats},
+            {"getAllMessagesFromChat", MessageType::GetAllMessagesFromChat},
+            {"signUp",                 MessageType::SignUp}
+    };
+
+    std::vector<std::pair<MessageType, uint32_t>> mix;
+    size_t begin = 0;
+    while (begin < value.size()) {
+        auto end = value.find(',', begin);
+        if (end == std::string::npos) {
+            end = value.size();
+        }
+
+        const auto entry = value.substr(begin, end - begin);
+        const auto separator = entry.find(':');
+        if (separator == std::string::npos || !types.contains(entry.substr(0, separator))) {
+            throw std::runtime_error("invalid mix entry " + entry);
+        }
+        mix.emplace_back(types.at(entry.substr(0, separator)), std::stoul(entry.substr(separator + 1)));
+
+        begin = end + 1;
+    }
+    return mix;
+}
+
+
+auto parseOptions(int argc, char *argv[]) -> Options {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const std::string argument(argv[i]);
+        const auto separator = argument.find('=');
+        const auto key = argument.substr(0, separator);
+        const auto value = (separator == std::string::npos) ? std::string() : argument.substr(separator + 1);
+
+        if (key == "--host") {
+            options.host = value;
+        } else if (key == "--sessions") {
+            options.sessions = std::stoul(value);
+        } else if (key == "--requests") {
+            options.requests = std::stoul(value);
+        } else if (key == "--legacy") {
+            options.legacy = true;
+        } else if (key == "--mix") {
+            options.mix = parseMix(value);
+        } else {
+            throw std::runtime_error("unknown option " + argument);
+        }
+    }
+
+    // legacy client signs up only in handshake of its connection
+    const auto hasSignUp = std::any_of(options.mix.begin(), options.mix.end(), [](const auto &entry) {
+        return entry.first == MessageType::SignUp && entry.second > 0;
+    });
+    if (options.legacy && hasSignUp) {
+        throw std::runtime_error("signUp in mix needs router connection");
+    }
+    return options;
+}
+
+
+class LoadSession {
+    const Options &options;
+    const std::string username;
+    const std::string chatName;
+    size_t chatsCreated{};
+    size_t usersSignedUp{};
+
+    zmqpp::socket socket;
+    // fresh users of mix are signed up here, so session of socket stays with own user
+    zmqpp::socket signUpSocket;
+    Samples samples{};
+
+    // sends request and records latency of round trip under request type
+    auto request(Message message) -> Message {
+        return request(socket, std::move(message));
+    }
+
+    auto request(zmqpp::socket &requestSocket, Message message) -> Message {
+        const auto type = message.type;
+        const auto start = std::chrono::steady_clock::now();
+
+        sendMessage(requestSocket, message);
+        receiveMessage(requestSocket, message);
+
+        samples.latencies[type].push_back(std::chrono::steady_clock::now() - start);
+        if (message.type == MessageType::ClientError || message.type == MessageType::ServerError ||
+            ((type == MessageType::SignUp) && message.authenticationStatus != AuthenticationStatus::Success)) {
+            samples.errors[type]++;
+        }
+        return message;
+    }
+
+    auto connect(zmqpp::socket &pushSocket) -> void {
+        socket.set(zmqpp::socket_option::send_timeout, sendTimeout);
+        socket.set(zmqpp::socket_option::receive_timeout, receiveTimeout);
+
+        if (!options.legacy) {
+            socket.connect("tcp://" + options.host + ":" + std::to_string(routerPort));
+
+            signUpSocket.set(zmqpp::socket_option::send_timeout, sendTimeout);
+            signUpSocket.set(zmqpp::socket_option::receive_timeout, receiveTimeout);
+            signUpSocket.connect("tcp://" + options.host + ":" + std::to_string(routerPort));
+            return;
+        }
+
+        // same handshake as interactive client had: bind, then push own endpoint for server to connect to
+        socket.bind("tcp://" + options.host + ":*");
+        std::string endPoint;
+        socket.get(zmqpp::socket_option::last_endpoint, endPoint);
+
+        zmqpp::message connectMessage;
+        connectMessage << endPoint;
+        if (!pushSocket.send(connectMessage)) {
+            throw std::runtime_error("send error");
+        }
+    }
+
+    auto createChat() -> void {
+        MessageData data;
+        data.buffer = chatsCreated++ == 0 ? chatName : chatName + "-" + std::to_string(chatsCreated);
+        data.vector.push_back(username);
+        request(Message(MessageType::CreateChat, data));
+    }
+
+    auto signUp() -> void {
+        const auto freshUsername = username + "-" + std::to_string(++usersSignedUp);
+        request(signUpSocket, Message(MessageType::SignUp, MessageData(freshUsername, "password")));
+    }
+
+public:
+    LoadSession(const Options &options, zmqpp::context &context, const std::string &runId, size_t index)
+            : options(options),
+              username("load-" + runId + "-" + std::to_string(index)),
+              chatName("load-" + runId + "-" + std::to_string(index)),
+              socket(context, zmqpp::socket_type::request),
+              signUpSocket(context, zmqpp::socket_type::request) {}
+
+    auto run(zmqpp::socket &pushSocket, std::mutex &pushMutex) -> void {
+        {
+            std::lock_guard lockGuard(pushMutex);
+            connect(pushSocket);
+        }
+
+        const auto response = request(Message(MessageType::SignUp, MessageData(username, "password")));
+        if (response.authenticationStatus != AuthenticationStatus::Success) {
+            throw std::runtime_error("sign up of " + username + " failed");
+        }
+        createChat();
+
+        std::vector<uint32_t> weights;
+        for (const auto &[type, weight]: options.mix) {
+            weights.push_back(weight);
+        }
+        std::mt19937 randomEngine(std::random_device{}());
+        std::discrete_distribution<size_t> distribution(weights.begin(), weights.end());
+
+        for (size_t i = 0; i < options.requests; i++) {
+            switch (options.mix[distribution(randomEngine)].first) {
+                case MessageType::CreateChat:
+                    createChat();
+                    break;
+                case MessageType::CreateMessage:
+                    request(Message(MessageType::CreateMessage, MessageData(chatName, "load message " + std::to_string(i))));
+                    break;
+                case MessageType::UpdateChats:
+                    request(Message(MessageType::UpdateChats, MessageData(0, username, "")));
+                    break;
+                case MessageType::GetAllMessagesFromChat:
+                    request(Message(MessageType::GetAllMessagesFromChat, MessageData(chatName, "")));
+                    break;
+                case MessageType::SignUp:
+                    signUp();
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    auto getSamples() -> Samples & {
+        return samples;
+    }
+};
+
+
+auto getPercentile(const std::vector<std::chrono::nanoseconds> &sorted, double percentile) -> double {
+    const auto index = std::min(sorted.size() - 1, static_cast<size_t>(percentile * static_cast<double>(sorted.size())));
+    return std::chrono::duration<double, std::milli>(sorted[index]).count();
+}
+
+
+auto report(Samples &samples, std::chrono::duration<double> elapsed) -> void {
+    std::cout << std::left << std::setw(24) << "type"
+              << std::right << std::setw(10) << "count"
+              << std::setw(8) << "errors"
+              << std::setw(12) << "req/s"
+              << std::setw(12) << "p50, ms"
+              << std::setw(12) << "p99, ms"
+              << std::setw(12) << "p999, ms" << std::endl;
+
+    size_t total = 0;
+    for (auto &[type, latencies]: samples.latencies) {
+        std::sort(latencies.begin(), latencies.end());
+        total += latencies.size();
+
+        std::cout << std::left << std::setw(24) << getMessageTypeName(type)
+                  << std::right << std::setw(10) << latencies.size()
+                  << std::setw(8) << samples.errors[type]
+                  << std::setw(12) << std::fixed << std::setprecision(1)
+                  << static_cast<double>(latencies.size()) / elapsed.count()
+                  << std::setw(12) << std::setprecision(3) << getPercentile(latencies, 0.5)
+                  << std::setw(12) << getPercentile(latencies, 0.99)
+                  << std::setw(12) << getPercentile(latencies, 0.999) << std::endl;
+    }
+
+    std::cout << "total " << total << " requests in " << std::setprecision(2) << elapsed.count() << " s, "
+              << std::setprecision(1) << static_cast<double>(total) / elapsed.count() << " req/s" << std::endl;
+}
+
+
+auto main(int argc, char *argv[]) -> int {
+    try {
+        const auto options = parseOptions(argc, argv);
+        const auto runId = std::to_string(std::chrono::system_clock::now().time_since_epoch().count());
+
+        zmqpp::context context;
+        zmqpp::socket pushSocket(context, zmqpp::socket_type::push);
+        pushSocket.set(zmqpp::socket_option::send_timeout, sendTimeout);
+        if (options.legacy) {
+            pushSocket.connect("tcp://" + options.host + ":" + std::to_string(pullPort));
+        }
+        std::mutex pushMutex;
+
+        std::vector<std::unique_ptr<LoadSession>> sessions;
+        for (size_t i = 0; i < options.sessions; i++) {
+            sessions.push_back(std::make_unique<LoadSession>(options, context, runId, i));
+        }
+
+        std::atomic<size_t> failedSessions{0};
+        const auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> threads;
+        for (auto &session: sessions) {
+            threads.emplace_back([&, &session = *session] {
+                try {
+                    session.run(pushSocket, pushMutex);
+                } catch (std::exception &exception) {
+                    std::cerr << exception.what() << std::endl;
+                    failedSessions++;
+                }
+            });
+        }
+        for (auto &thread: threads) {
+            thread.join();
+        }
+
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        Samples samples;
+        for (auto &session: sessions) {
+            samples.merge(session->getSamples());
+        }
+
+        report(samples, elapsed);
+        if (failedSessions > 0) {
+            std::cerr << failedSessions << " sessions failed" << std::endl;
+            return 2;
+        }
+    } catch (zmqpp::exception &exception) {
+        std::cerr << "caught zmq exception: " << exception.what() << std::endl;
+        return 1;
+    } catch (std::exception &exception) {
+        std::cerr << exception.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,15 +1,27 @@
-#include <set>
 #include <deque>
+#include <cstdlib>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <chrono>
 #include <string>
 #include <thread>
+#include <fstream>
 #include <utility>
-#include <iostream>
+#include <optional>
 #include <algorithm>
+#include <stdexcept>
+#include <shared_mutex>
+#include <unordered_map>
 #include <zmqpp/zmqpp.hpp>
 
 
 #include "lib/user.hpp"
+#include "lib/logging.hpp"
+#include "lib/metrics.hpp"
 #include "lib/database.hpp"
+#include "lib/sessionTokens.hpp"
+#include "lib/publisher.hpp"
 #include "lib/messaging.hpp"
 #include "lib/networking.hpp"
 
@@ -18,41 +30,378 @@ constexpr int32_t sendTimeout = 10 * 1000;
 constexpr int32_t receiveTimeout = 10 * 1000;
 
 
+const std::string workersEndPoint = "inproc://workers";
+
+constexpr size_t maxBatchSize = 1000;
+
+// notifications waiting for publisher thread, and waiting for each subscriber in socket
+constexpr size_t publishQueueCapacity = 100000;
+constexpr int subscriberQueueCapacity = 10000;
+
+// client restores evicted session with Resume, so idle sessions don't have to be kept
+constexpr auto sessionIdleTimeout = std::chrono::minutes(30);
+
+
+struct Session {
+    User user{};
+    // accepted during SignIn/SignUp/Resume, applies to every response of session
+    Compression compression{};
+    // steady clock ticks, refreshed under shared lock by every request
+    std::atomic<std::chrono::steady_clock::rep> lastRequestTime{};
+};
+
+
+// metrics of requests of one type, labeled by type name
+struct RequestMetrics {
+    Counter &requests;
+    Counter &errors;
+    Counter &receivedBytes;
+    Counter &sentBytes;
+    Histogram &latency;
+
+    explicit RequestMetrics(const std::string &label);
+};
+
+
+// CP_DATABASE_SHARDS environment variable, 0 keeps every table in central file
+static auto getShardsCount() -> size_t {
+    const auto *shardsCount = std::getenv("CP_DATABASE_SHARDS");
+    return shardsCount ? std::stoul(shardsCount) : 0;
+}
+
+
+// CP_MESSAGE_STORAGE environment variable, sqlite or log
+static auto getMessageStorage() -> Database::MessageStorage {
+    const auto *messageStorage = std::getenv("CP_MESSAGE_STORAGE");
+    if (!messageStorage || std::string(messageStorage) == "sqlite") {
+        return Database::MessageStorage::Sqlite;
+    }
+    if (std::string(messageStorage) == "log") {
+        return Database::MessageStorage::Log;
+    }
+    throw std::runtime_error("unknown message storage " + std::string(messageStorage));
+}
+
+
+// CP_ADMIN_USERNAME environment variable, only this user gets metrics through Stats; unset refuses Stats to everyone
+static auto getAdminUsername() -> std::string {
+    const auto *adminUsername = std::getenv("CP_ADMIN_USERNAME");
+    return adminUsername ? adminUsername : "";
+}
+
+
+// Threads line of /proc/self/status, so committer, logger and zmq threads are counted too; 0 if it can't be read
+static auto getThreadsCount() -> size_t {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.starts_with("Threads:")) {
+            return std::stoul(line.substr(8));
+        }
+    }
+    return 0;
+}
+
+
 class Server {
-    Database db{};
+    Database db{"database.db", getShardsCount(), getMessageStorage()};
+
+    // issued on authentication, Resume restores session without database round trip
+    SessionTokens sessionTokens{"session.key"};
+
+    // internal metrics are answered only to this user, see getAdminUsername
+    const std::string adminUsername{getAdminUsername()};
 
     zmqpp::context context{};
     zmqpp::socket pullSocket{context, zmqpp::socket_type::pull};
 
-    std::set<User> users{db.getAllUsers()};
+    // router clients, requests are spread over fixed pool of workers
+    zmqpp::socket routerSocket{context, zmqpp::socket_type::router};
+    zmqpp::socket workersSocket{context, zmqpp::socket_type::dealer};
+    size_t workersCount{std::max(std::thread::hardware_concurrency(), 1u)};
+
+    // authenticated router clients, keyed by routing frames, see getSessionKey
+    std::unordered_map<std::string, Session> sessions;
+    std::shared_mutex sessionsMutex;
+    // steady clock ticks, first worker that passes it evicts idle sessions
+    std::atomic<std::chrono::steady_clock::rep> nextSessionsEviction{};
+
+    // server-push notifications, every user subscribes to userTopic of own username and chatTopic of own chats
+    Publisher publisher{context, publishQueueCapacity, subscriberQueueCapacity};
+
+    // started only behind broker, publishes invalidations to its internal bus, which clients can't reach
+    Publisher invalidationPublisher{context, publishQueueCapacity, subscriberQueueCapacity};
+
+    // set behind broker, invalidations published by every server process are received from its internal bus
+    std::string invalidationsEndPoint{};
+
     std::deque<std::thread> threads;
 
-    auto findUser(const std::string &username) noexcept;
+    // running clientMonitor threads, one per legacy client
+    std::atomic<size_t> clientMonitorsCount{};
+
+    // registered on first request of known type, see getRequestMetrics
+    std::unordered_map<MessageType, std::unique_ptr<RequestMetrics>> requestMetrics;
+    std::shared_mutex requestMetricsMutex;
+
+    auto getRequestMetrics(MessageType type) -> RequestMetrics &;
+
+    // latency is counted from start to now, response of error type is counted as error
+    auto recordRequest(
+            MessageType type,
+            size_t receivedBytes,
+            size_t sentBytes,
+            const Message &response,
+            std::chrono::steady_clock::time_point start
+    ) -> void;
+
+    // exposes sessions and threads as gauges
+    auto registerGauges() -> void;
+
+    // erases sessions idle longer than sessionIdleTimeout, runs at most once per timeout
+    auto evictIdleSessions() -> void;
+
+    // user created by another server process is read from database
+    auto findUser(const std::string &username) -> std::optional<User>;
+
+    // publishes notification to user, never blocks on slow subscribers
+    auto notify(int32_t userId, Message notification) -> void;
+
+    // publishes hint of new message once on topic of chat, so cost doesn't grow with members count;
+    // topics aren't authenticated, so members fetch message itself with GetMessagesPage, which checks membership
+    auto publishMessage(const std::string &chatName, const ChatMessage &chatMessage) -> void;
+
+    // tells every server process sharing database to reread chat into its cache; invalidation may be dropped
+    // by publisher or missed by subscriber that isn't connected yet, then chat is reread when its cache entries expire
+    auto invalidateChat(const std::string &chatName) -> void;
+
+    // applies invalidations published by every server process, own ones included
+    auto invalidationMonitor() -> void;
+
+    // identity of client, prefixed by identity of broker when request is forwarded by it
+    static auto getSessionKey(const Envelope &envelope) -> std::string;
 
     auto connectionMonitor() -> void;
 
+    // authRequest must be SignIn, SignUp or Resume, fills user on success
+    auto authenticate(const Message &authRequest, User &user) -> AuthenticationStatus;
+
+    static auto isAuthRequest(const Message &message) -> bool;
+
     auto attachClient(zmqpp::socket &clientSocket, const std::string &clientEndPoint) -> User;
 
+    // returns response for request of authenticated user
+    auto handleRequest(const User &user, Message &message) -> Message;
+
+    // returns responses of sub-requests in their order, consecutive CreateMessage ones are inserted in one write
+    auto handleBatch(const User &user, std::vector<Message> &requests) -> std::vector<Message>;
+
     auto clientMonitor(const std::string &clientEndPoint) noexcept -> void;
 
+    // forwards requests between router clients and workers
+    auto routerMonitor() -> void;
+
+    auto worker() noexcept -> void;
+
 public:
     static auto get() -> Server &;
 
     auto configurePullSocketEndPoint(const std::string &endPoint) -> void;
 
+    auto configureRouterSocketEndPoint(const std::string &endPoint) -> void;
+
+    auto configureWorkers(size_t count) -> void;
+
+    auto configureGroupCommit(size_t maxBatchSize, std::chrono::microseconds maxBatchDelay) -> void;
+
+    auto configurePublishSocketEndPoint(const std::string &endPoint) -> void;
+
+    // notifications are published to XSUB end point of broker, invalidations are published to XSUB end point
+    // of its internal bus and received from XPUB end point of it
+    auto configureBroker(
+            const std::string &publishEndPoint,
+            const std::string &internalPublishEndPoint,
+            const std::string &internalSubscribeEndPoint
+    ) -> void;
+
     auto run() -> void;
 };
 
 
-auto Server::findUser(const std::string &username) noexcept {
-    return std::find_if(users.begin(), users.end(), [&username](auto user) -> bool {
-        return user.username == username;
+static auto typeLabel(MessageType type) -> std::string {
+    return "type=\"" + getMessageTypeName(type) + "\"";
+}
+
+
+RequestMetrics::RequestMetrics(const std::string &label)
+        : requests(Metrics::get().counter("cp_requests_total", "Handled requests", label)),
+          errors(Metrics::get().counter("cp_request_errors_total", "Requests answered with ClientError or ServerError",
+                                        label)),
+          receivedBytes(Metrics::get().counter("cp_received_bytes_total", "Bytes of request frames", label)),
+          sentBytes(Metrics::get().counter("cp_sent_bytes_total", "Bytes of response frames", label)),
+          latency(Metrics::get().histogram("cp_request_duration_seconds",
+                                           "Time from request receive to response send", label)) {}
+
+
+auto Server::getRequestMetrics(MessageType type) -> RequestMetrics & {
+    // type comes from client before authentication, so unknown ones share one series instead of adding one per value
+    if (!isKnownMessageType(type)) {
+        static RequestMetrics unknownMetrics("type=\"unknown\"");
+        return unknownMetrics;
+    }
+
+    {
+        std::shared_lock lock(requestMetricsMutex);
+        if (auto it = requestMetrics.find(type); it != requestMetrics.end()) {
+            return *it->second;
+        }
+    }
+
+    std::lock_guard lockGuard(requestMetricsMutex);
+    auto &metrics = requestMetrics[type];
+    if (!metrics) {
+        metrics = std::make_unique<RequestMetrics>(typeLabel(type));
+    }
+    return *metrics;
+}
+
+
+auto Server::recordRequest(
+        MessageType type,
+        size_t receivedBytes,
+        size_t sentBytes,
+        const Message &response,
+        std::chrono::steady_clock::time_point start
+) -> void {
+    auto &metrics = getRequestMetrics(type);
+    metrics.latency.observe(std::chrono::steady_clock::now() - start);
+    metrics.requests.add();
+    metrics.receivedBytes.add(receivedBytes);
+    metrics.sentBytes.add(sentBytes);
+    if (response.type == MessageType::ClientError || response.type == MessageType::ServerError) {
+        metrics.errors.add();
+    }
+}
+
+
+auto Server::registerGauges() -> void {
+    Metrics::get().gauge("cp_sessions_active", "Authenticated router sessions and attached legacy clients", [this] {
+        std::shared_lock lock(sessionsMutex);
+        return static_cast<double>(sessions.size() + clientMonitorsCount);
+    });
+    Metrics::get().gauge("cp_publish_queue_size", "Notifications and invalidations waiting for publisher threads", [this] {
+        return static_cast<double>(publisher.size() + invalidationPublisher.size());
     });
+    Metrics::get().gauge("cp_threads", "Threads of server process", [] {
+        return static_cast<double>(getThreadsCount());
+    });
+}
+
+
+auto Server::evictIdleSessions() -> void {
+    const auto now = std::chrono::steady_clock::now();
+    const auto timeout = std::chrono::duration_cast<std::chrono::steady_clock::duration>(sessionIdleTimeout);
+
+    auto nextEviction = nextSessionsEviction.load(std::memory_order_relaxed);
+    if (now.time_since_epoch().count() < nextEviction ||
+        !nextSessionsEviction.compare_exchange_strong(nextEviction, (now + timeout).time_since_epoch().count())) {
+        return;
+    }
+
+    const auto evictedBefore = (now - timeout).time_since_epoch().count();
+    std::lock_guard lockGuard(sessionsMutex);
+    const auto evictedCount = std::erase_if(sessions, [&](const auto &entry) {
+        return entry.second.lastRequestTime.load(std::memory_order_relaxed) < evictedBefore;
+    });
+    if (evictedCount > 0) {
+        logInfo("evicted ", evictedCount, " idle sessions");
+    }
+}
+
+
+auto Server::findUser(const std::string &username) -> std::optional<User> {
+    if (auto user = db.getUserDirectory().find(username)) {
+        return user;
+    }
+
+    db.reloadUser(username);
+    return db.getUserDirectory().find(username);
+}
+
+
+auto Server::notify(int32_t userId, Message notification) -> void {
+    auto user = db.getUserDirectory().find(userId);
+    if (!user) {
+        return;
+    }
+
+    publisher.publish(userTopic(user->username), std::move(notification));
+}
+
+
+auto Server::publishMessage(const std::string &chatName, const ChatMessage &chatMessage) -> void {
+    auto notification = Message(MessageType::NewMessage, MessageData(chatName, ""));
+    notification.data.cursor = chatMessage.id;
+    publisher.publish(chatTopic(chatName), std::move(notification));
+}
+
+
+auto Server::invalidateChat(const std::string &chatName) -> void {
+    // single server process keeps its cache current itself
+    if (invalidationsEndPoint.empty()) {
+        return;
+    }
+    invalidationPublisher.publish(invalidationTopic(),
+                                  Message(MessageType::ChatInvalidated, MessageData(chatName, "")));
+}
+
+
+auto Server::invalidationMonitor() -> void {
+    logInfo("invalidationMonitor started");
+    try {
+        zmqpp::socket subscribeSocket(context, zmqpp::socket_type::subscribe);
+        subscribeSocket.connect(invalidationsEndPoint);
+        subscribeSocket.subscribe(invalidationTopic());
+
+        while (true) {
+            Envelope envelope;
+            Message message;
+            try {
+                receiveMessage(subscribeSocket, envelope, message);
+            } catch (zmqpp::exception &) {
+                throw;
+            } catch (std::exception &exception) {
+                logWarning("malformed invalidation: ", exception.what());
+                continue;
+            }
+
+            try {
+                if (message.type == MessageType::ChatInvalidated) {
+                    db.reloadChat(message.data.name);
+                }
+            } catch (std::runtime_error &exception) {
+                logError(exception.what());
+            }
+        }
+    } catch (zmqpp::exception &exception) {
+        logError("invalidationMonitor caught zmqpp exception: ", exception.what());
+    }
+    logWarning("invalidationMonitor exiting, chats changed by other server processes may be stale");
+}
+
+
+auto Server::getSessionKey(const Envelope &envelope) -> std::string {
+    // frames are length prefixed, as identities are binary
+    std::string key;
+    for (const auto &frame: envelope) {
+        key += std::to_string(frame.size()) + ":" + frame;
+    }
+    return key;
 }
 
 
 auto Server::connectionMonitor() -> void {
-    std::cout << "connectionMonitor started" << std::endl;
+    logInfo("connectionMonitor started");
     try {
         while (pullSocket) {
             zmqpp::message message;
@@ -65,57 +414,86 @@ auto Server::connectionMonitor() -> void {
             threads.push_back(std::move(connectionMonitorThread));
         }
     } catch (zmqpp::exception &exception) {
-        std::cout << "connectionMonitor caught zmqpp exception: " << exception.what() << std::endl;
+        logError("connectionMonitor caught zmqpp exception: ", exception.what());
     } catch (...) {
-        std::cout << "connectionMonitor caught undefined exception" << std::endl;
+        logError("connectionMonitor caught undefined exception");
     }
-    std::cout << "connectionMonitor exiting, new connections won't be maintained" << std::endl;
+    logWarning("connectionMonitor exiting, new connections won't be maintained");
 }
 
 
-auto Server::attachClient(zmqpp::socket &clientSocket, const std::string &clientEndPoint) -> User {
-    clientSocket.set(zmqpp::socket_option::send_timeout, sendTimeout);
-    clientSocket.set(zmqpp::socket_option::receive_timeout, receiveTimeout);
-
-    clientSocket.connect(clientEndPoint);
-
-    User user;
-    Message authRequest;
-    receiveMessage(clientSocket, authRequest);
+auto Server::authenticate(const Message &authRequest, User &user) -> AuthenticationStatus {
+    if (authRequest.type == MessageType::Resume) {
+        // invalid or expired token is rejected like wrong password, client falls back to SignIn
+        auto tokenUser = sessionTokens.verify(authRequest.data.buffer);
+        if (!tokenUser) {
+            return AuthenticationStatus::InvalidPassword;
+        }
+        user = std::move(*tokenUser);
+        return AuthenticationStatus::Success;
+    }
 
     user.username = authRequest.data.name;
 
     AuthenticationStatus status;
     if (authRequest.type == MessageType::SignIn) {
-        if (findUser(authRequest.data.name) == users.end()) {
+        if (auto existingUser = findUser(authRequest.data.name); !existingUser) {
             status = AuthenticationStatus::NotExists;
         } else {
             status = db.authenticateUser(authRequest.data.name, authRequest.data.buffer);
-            user.id = db.getUserId(user.username);
+            user.id = existingUser->id;
         }
-    } else if (authRequest.type == MessageType::SignUp) {
-        if (findUser(authRequest.data.name) != users.end()) {
+    } else {
+        if (findUser(authRequest.data.name)) {
             status = AuthenticationStatus::Exists;
         } else {
-            db.createUser(authRequest.data.name, authRequest.data.buffer);
-            user.id = db.getUserId(user.username);
-            if (user.id == -1) {
-                throw std::runtime_error("unexpected createUser result");
-            }
-            status = AuthenticationStatus::Success;
-            users.insert(user);
+            // concurrent sign up with same username is rejected by database
+            user.id = db.createUser(authRequest.data.name, authRequest.data.buffer);
+            status = (user.id == -1) ? AuthenticationStatus::Exists : AuthenticationStatus::Success;
         }
-    } else {
-        sendMessage(clientSocket, Message(MessageType::ClientError));
-        throw std::runtime_error("invalid massage type");
     }
 
+    return status;
+}
+
+
+auto Server::isAuthRequest(const Message &message) -> bool {
+    return message.type == MessageType::SignIn || message.type == MessageType::SignUp ||
+           message.type == MessageType::Resume;
+}
+
+
+auto Server::attachClient(zmqpp::socket &clientSocket, const std::string &clientEndPoint) -> User {
+    clientSocket.set(zmqpp::socket_option::send_timeout, sendTimeout);
+    clientSocket.set(zmqpp::socket_option::receive_timeout, receiveTimeout);
+
+    clientSocket.connect(clientEndPoint);
+
+    User user;
+    Message authRequest;
+    const auto receivedBytes = receiveMessage(clientSocket, authRequest);
+    const auto start = std::chrono::steady_clock::now();
+
+    if (!isAuthRequest(authRequest)) {
+        auto errorResponse = Message(MessageType::ClientError);
+        errorResponse.format = authRequest.format;
+        errorResponse.requestId = authRequest.requestId;
+        const auto sentBytes = sendMessage(clientSocket, errorResponse);
+        recordRequest(authRequest.type, receivedBytes, sentBytes, errorResponse, start);
+        throw std::runtime_error("invalid massage type");
+    }
 
     Message authResponse;
-    authResponse.authenticationStatus = status;
-    sendMessage(clientSocket, authResponse);
+    authResponse.format = authRequest.format;
+    authResponse.requestId = authRequest.requestId;
+    authResponse.authenticationStatus = authenticate(authRequest, user);
+    if (authResponse.authenticationStatus == AuthenticationStatus::Success) {
+        authResponse.data.buffer = sessionTokens.issue(user);
+    }
+    const auto sentBytes = sendMessage(clientSocket, authResponse);
+    recordRequest(authRequest.type, receivedBytes, sentBytes, authResponse, start);
 
-    if (status != AuthenticationStatus::Success) {
+    if (authResponse.authenticationStatus != AuthenticationStatus::Success) {
         throw std::runtime_error("auth error");
     }
 
@@ -123,9 +501,177 @@ auto Server::attachClient(zmqpp::socket &clientSocket, const std::string &client
 }
 
 
+auto Server::handleRequest(const User &user, Message &message) -> Message {
+    switch (message.type) {
+        case MessageType::CreateMessage: {
+            try {
+                auto chatMessage = db.createMessage(message.data.name, user.id, time(nullptr), message.data.buffer);
+                if (!chatMessage) {
+                    return Message(MessageType::ClientError, "Chat " + message.data.name + " doesn't exists");
+                }
+                publishMessage(message.data.name, *chatMessage);
+            } catch (std::runtime_error &exception) {
+                logError(exception.what());
+                return Message(MessageType::ServerError);
+            }
+            break;
+        }
+        case MessageType::Update: {
+            break;
+        }
+        case MessageType::UpdateChats: {
+            logDebug("update chats received");
+            // chats of session's user only, name of request is ignored
+            try {
+                message.data.vector = db.getChatsByTime(user.id, message.data.time);
+            } catch (std::runtime_error &exception) {
+                logError(exception.what());
+                return Message(MessageType::ServerError);
+            }
+            message.data.time = time(nullptr);
+            break;
+        }
+        case MessageType::CreateChat: {
+            std::vector<int32_t> userIds;
+            userIds.reserve(message.data.vector.size());
+
+            for (const auto &username: message.data.vector) {
+                auto member = findUser(username);
+                if (!member) {
+                    return Message(MessageType::ClientError, MessageData("User " + username + " doesn't exists"));
+                }
+                userIds.push_back(member->id);
+            }
+
+            try {
+                if (!db.createChat(message.data.buffer, user.id, userIds)) {
+                    return Message(MessageType::ClientError, MessageData("Chat exists"));
+                }
+                invalidateChat(message.data.buffer);
+                for (const auto &userId: userIds) {
+                    notify(userId, Message(MessageType::ChatAdded));
+                }
+            } catch (std::runtime_error &exception) {
+                logError(exception.what());
+                return Message(MessageType::ServerError);
+            }
+            break;
+        }
+        case MessageType::GetAllMessagesFromChat: {
+            try {
+                message.data.chatMessages = db.getAllMessagesFromChat(message.data.name, user.id);
+            } catch (std::logic_error &exception) {
+                logError(exception.what());
+                return Message(MessageType::ClientError, MessageData(
+                        "Chat " + message.data.name + " doesn't exists"));
+            } catch (std::runtime_error &) {
+                return Message(MessageType::ServerError);
+            }
+            break;
+        }
+        case MessageType::GetMessagesPage: {
+            try {
+                auto page = db.getMessagesPage(message.data.name, user.id, message.data.cursor, message.data.limit,
+                                               message.data.flag);
+                message.data.chatMessages = std::move(page.messages);
+                message.data.cursor = page.nextCursor;
+            } catch (std::logic_error &exception) {
+                logError(exception.what());
+                return Message(MessageType::ClientError, MessageData(
+                        "Chat " + message.data.name + " doesn't exists"));
+            } catch (std::runtime_error &) {
+                return Message(MessageType::ServerError);
+            }
+            break;
+        }
+        case MessageType::InviteUserToChat: {
+            auto invitee = findUser(message.data.buffer);
+            if (!invitee) {
+                message.type = MessageType::ClientError;
+                break;
+            }
+
+            try {
+                db.inviteUserToChat(message.data.name, user.id, invitee->id, message.data.flag);
+                invalidateChat(message.data.name);
+                notify(invitee->id, Message(MessageType::ChatAdded));
+            } catch (std::runtime_error &exception) {
+                logError(exception.what());
+                return Message(MessageType::ServerError);
+            }
+            break;
+        }
+        case MessageType::Stats: {
+            if (adminUsername.empty() || user.username != adminUsername) {
+                return Message(MessageType::ClientError, MessageData("Stats is allowed only to admin"));
+            }
+            message.data.buffer = Metrics::get().render();
+            break;
+        }
+        case MessageType::Batch: {
+            if (message.batch.size() > maxBatchSize) {
+                return Message(MessageType::ClientError, MessageData("Batch is too large"));
+            }
+            message.batch = handleBatch(user, message.batch);
+            break;
+        }
+        default:
+            break;
+    }
+
+    return message;
+}
+
+
+auto Server::handleBatch(const User &user, std::vector<Message> &requests) -> std::vector<Message> {
+    std::vector<Message> responses;
+    responses.reserve(requests.size());
+
+    for (size_t i = 0; i < requests.size();) {
+        auto &request = requests[i];
+        if (isAuthRequest(request) || request.type == MessageType::Batch) {
+            responses.emplace_back(MessageType::ClientError, MessageData("Not allowed in batch"));
+            i++;
+            continue;
+        }
+
+        if (request.type != MessageType::CreateMessage) {
+            responses.push_back(handleRequest(user, request));
+            i++;
+            continue;
+        }
+
+        std::vector<std::pair<std::string, std::string>> messages;
+        for (; i < requests.size() && requests[i].type == MessageType::CreateMessage; i++) {
+            messages.emplace_back(std::move(requests[i].data.name), std::move(requests[i].data.buffer));
+        }
+
+        try {
+            auto created = db.createMessages(user.id, time(nullptr), messages);
+            for (size_t j = 0; j < messages.size(); j++) {
+                const auto &chatName = messages[j].first;
+                if (!created[j]) {
+                    responses.emplace_back(MessageType::ClientError, MessageData("Chat " + chatName + " doesn't exists"));
+                    continue;
+                }
+
+                publishMessage(chatName, *created[j]);
+                responses.emplace_back(MessageType::CreateMessage);
+            }
+        } catch (std::runtime_error &exception) {
+            logError(exception.what());
+            responses.resize(responses.size() + messages.size(), Message(MessageType::ServerError));
+        }
+    }
+
+    return responses;
+}
+
+
 auto Server::clientMonitor(const std::string &clientEndPoint) noexcept -> void {
-    std::cout << "new clientMonitor started, monitoring " << clientEndPoint << " port" << std::endl;
+    logInfo("new clientMonitor started, monitoring ", clientEndPoint, " port");
 
+    clientMonitorsCount++;
     try {
         zmqpp::socket clientSocket(context, zmqpp::socket_type::reply);
 
@@ -133,120 +679,142 @@ auto Server::clientMonitor(const std::string &clientEndPoint) noexcept -> void {
 
         while (true) {
             Message message;
-            receiveMessage(clientSocket, message);
-            switch (message.type) {
-                case MessageType::CreateMessage: {
-                    try {
-                        if (!db.createMessage(message.data.name, user.id, time(nullptr), message.data.buffer)) {
-                            sendMessage(clientSocket, Message(MessageType::ClientError,
-                                                              "Chat " + message.data.buffer + " doesn't exists"));
-                            continue;
-                        }
-                    } catch (std::runtime_error &exception) {
-                        std::cerr << exception.what() << std::endl;
-                        sendMessage(clientSocket, Message(MessageType::ServerError));
-                        continue;
-                    }
-                    break;
-                }
-                case MessageType::Update: {
-                    break;
-                }
-                case MessageType::UpdateChats: {
-                    std::cout << "update chats received" << std::endl;
-                    auto it = findUser(message.data.name);
-                    if (it == users.end()) {
-                        message.type = MessageType::ClientError;
-                        break;
-                    }
+            const auto receivedBytes = receiveMessage(clientSocket, message);
+            const auto start = std::chrono::steady_clock::now();
+            const auto type = message.type;
 
-                    try {
-                        message.data.vector = db.getChatsByTime(it->id, message.data.time);
-                    } catch (std::runtime_error &exception) {
-                        std::cerr << exception.what() << std::endl;
-                        sendMessage(clientSocket, Message(MessageType::ServerError));
-                        continue;
-                    }
-                    message.data.time = time(nullptr);
-                    break;
-                }
-                case MessageType::CreateChat: {
-                    std::vector<int32_t> userIds;
-                    userIds.reserve(message.data.vector.size());
-
-                    auto flag = false;
-                    for (const auto &username: message.data.vector) {
-                        auto it = findUser(username);
-                        if (it != users.end()) {
-                            userIds.push_back(it->id);
-                        } else {
-                            message = Message(MessageType::ClientError,
-                                              MessageData("User " + username + " doesn't exists"));
-                            sendMessage(clientSocket, message);
-                            flag = true;
-                            break;
-                        }
-                    }
+            auto response = handleRequest(user, message);
+            response.format = message.format;
+            response.requestId = message.requestId;
 
-                    if (!flag) {
-                        try {
-                            if (!db.createChat(message.data.buffer, user.id, userIds)) {
-                                sendMessage(clientSocket,
-                                            Message(MessageType::ClientError, MessageData("Chat exists")));
-                                continue;
-                            }
-                        } catch (std::runtime_error &exception) {
-                            std::cerr << exception.what() << std::endl;
-                            sendMessage(clientSocket, Message(MessageType::ServerError));
-                            continue;
-                        }
-                    }
-                    break;
-                }
-                case MessageType::GetAllMessagesFromChat: {
-                    try {
-                        message.data.chatMessages = db.getAllMessagesFromChat(message.data.name, user.id);
-                    } catch (std::logic_error &exception) {
-                        std::cerr << exception.what() << std::endl;
-                        sendMessage(clientSocket, Message(MessageType::ClientError, MessageData(
-                                "Chat " + message.data.name + " doesn't exists")));
-                        continue;
-                    } catch (std::runtime_error &) {
-                        sendMessage(clientSocket, Message(MessageType::ServerError));
-                        continue;
+            logDebug("sending request back");
+            const auto sentBytes = sendMessage(clientSocket, response);
+            recordRequest(type, receivedBytes, sentBytes, response, start);
+        }
+    } catch (zmqpp::exception &exception) {
+        logError("caught zmq exception: ", exception.what());
+    } catch (std::runtime_error &exception) {
+        logError(exception.what());
+    }
+
+    clientMonitorsCount--;
+    logInfo("client monitor exiting");
+}
+
+
+auto Server::routerMonitor() -> void {
+    logInfo("routerMonitor started");
+    try {
+        zmqpp::poller poller;
+        poller.add(routerSocket);
+        poller.add(workersSocket);
+
+        while (poller.poll()) {
+            if (poller.has_input(routerSocket)) {
+                zmqpp::message message;
+                routerSocket.receive(message);
+                workersSocket.send(message);
+            }
+            if (poller.has_input(workersSocket)) {
+                zmqpp::message message;
+                workersSocket.receive(message);
+                routerSocket.send(message);
+            }
+        }
+    } catch (zmqpp::exception &exception) {
+        logError("routerMonitor caught zmqpp exception: ", exception.what());
+    }
+    logWarning("routerMonitor exiting, router clients won't be maintained");
+}
+
+
+auto Server::worker() noexcept -> void {
+    static auto &malformedRequests = Metrics::get().counter("cp_malformed_requests_total",
+                                                            "Requests that couldn't be unpacked");
+    try {
+        zmqpp::socket workerSocket(context, zmqpp::socket_type::dealer);
+        workerSocket.connect(workersEndPoint);
+
+        while (true) {
+            Envelope envelope;
+            Message message;
+            size_t receivedBytes;
+            try {
+                receivedBytes = receiveMessage(workerSocket, envelope, message);
+            } catch (zmqpp::exception &) {
+                throw;
+            } catch (std::exception &) {
+                malformedRequests.add();
+                // malformed request, envelope is filled before payload is unpacked;
+                // encoding of request is unknown, legacy one is understood by every client
+                auto errorResponse = Message(MessageType::ClientError);
+                errorResponse.format = WireFormat::Legacy;
+                sendMessage(workerSocket, envelope, errorResponse);
+                continue;
+            }
+
+            const auto sessionKey = getSessionKey(envelope);
+            const auto start = std::chrono::steady_clock::now();
+            const auto type = message.type;
+
+            Message response;
+            try {
+                if (isAuthRequest(message)) {
+                    User user;
+                    response.authenticationStatus = authenticate(message, user);
+                    if (response.authenticationStatus == AuthenticationStatus::Success) {
+                        response.data.buffer = sessionTokens.issue(user);
+
+                        // every compression client can offer is supported
+                        response.compression = message.compression;
+
+                        std::lock_guard lockGuard(sessionsMutex);
+                        auto &session = sessions[sessionKey];
+                        session.user = user;
+                        session.compression = message.compression;
+                        session.lastRequestTime = start.time_since_epoch().count();
                     }
-                    break;
-                }
-                case MessageType::InviteUserToChat: {
-                    auto it = findUser(message.data.buffer);
-                    if (it == users.end()) {
-                        message.type = MessageType::ClientError;
-                        break;
+                } else {
+                    std::optional<User> user;
+                    Compression compression{};
+                    {
+                        std::shared_lock lock(sessionsMutex);
+                        if (auto it = sessions.find(sessionKey); it != sessions.end()) {
+                            user = it->second.user;
+                            compression = it->second.compression;
+                            it->second.lastRequestTime.store(start.time_since_epoch().count(),
+                                                             std::memory_order_relaxed);
+                        }
                     }
 
-                    try {
-                        db.inviteUserToChat(message.data.name, user.id, it->id, message.data.flag);
-                    } catch (std::runtime_error &exception) {
-                        std::cerr << exception.what() << std::endl;
-                        sendMessage(clientSocket, Message(MessageType::ServerError));
-                        continue;
+                    if (user) {
+                        response = handleRequest(*user, message);
+                        response.compression = compression;
+                    } else {
+                        // unknown session, e.g. after restart, client can restore it with Resume
+                        response = Message(MessageType::ClientError, MessageData("Not authenticated"));
+                        response.authenticationStatus = AuthenticationStatus::NotExists;
                     }
-                    break;
                 }
-                default:
-                    break;
+            } catch (std::runtime_error &exception) {
+                logError(exception.what());
+                response = Message(MessageType::ServerError);
             }
 
-            std::cout << "sending request back" << std::endl;
-            sendMessage(clientSocket, message);
+            response.format = message.format;
+            response.requestId = message.requestId;
+            const auto sentBytes = sendMessage(workerSocket, envelope, response);
+            recordRequest(type, receivedBytes, sentBytes, response, start);
+
+            evictIdleSessions();
         }
     } catch (zmqpp::exception &exception) {
-        std::cerr << "caught zmq exception: " << exception.what() << std::endl;
+        logError("worker caught zmq exception: ", exception.what());
     } catch (std::runtime_error &exception) {
-        std::cerr << exception.what() << std::endl;
+        logError(exception.what());
     }
 
-    std::cout << "client monitor exiting" << std::endl;
+    logWarning("worker exiting");
 }
 
 
@@ -261,22 +829,105 @@ auto Server::configurePullSocketEndPoint(const std::string &endPoint) -> void {
 }
 
 
+auto Server::configureRouterSocketEndPoint(const std::string &endPoint) -> void {
+    routerSocket.bind(endPoint);
+    workersSocket.bind(workersEndPoint);
+}
+
+
+auto Server::configureWorkers(size_t count) -> void {
+    workersCount = std::max<size_t>(count, 1);
+}
+
+
+auto Server::configureGroupCommit(size_t maxBatchSize, std::chrono::microseconds maxBatchDelay) -> void {
+    db.configureGroupCommit(maxBatchSize, maxBatchDelay);
+}
+
+
+auto Server::configurePublishSocketEndPoint(const std::string &endPoint) -> void {
+    publisher.bind(endPoint);
+}
+
+
+auto Server::configureBroker(
+        const std::string &publishEndPoint,
+        const std::string &internalPublishEndPoint,
+        const std::string &internalSubscribeEndPoint
+) -> void {
+    publisher.connect(publishEndPoint);
+    invalidationPublisher.connect(internalPublishEndPoint);
+    invalidationsEndPoint = internalSubscribeEndPoint;
+}
+
+
 auto Server::run() -> void {
+    registerGauges();
+
+    // added before connectionMonitor starts adding its threads
+    if (!invalidationsEndPoint.empty()) {
+        threads.emplace_back(&Server::invalidationMonitor, &Server::get());
+    }
+
     std::thread pullerThread(&Server::connectionMonitor, &Server::get());
+    std::thread routerThread(&Server::routerMonitor, &Server::get());
+
+    std::vector<std::thread> workers;
+    workers.reserve(workersCount);
+    for (size_t i = 0; i < workersCount; i++) {
+        workers.emplace_back(&Server::worker, &Server::get());
+    }
+
     pullerThread.join();
+    routerThread.join();
 
     for (auto &thread: threads) {
         thread.join();
     }
+    for (auto &thread: workers) {
+        thread.join();
+    }
 }
 
 
-auto main() -> int {
+// usage: server [workers count] [message batch size] [message batch delay, us] [bind address]
+// CP_LOG_LEVEL environment variable sets log level: debug, info, warning, error or off
+// CP_DATABASE_SHARDS environment variable sets count of message shard files, see Database
+// CP_ADMIN_USERNAME environment variable names user allowed to read metrics with Stats
+// CP_MESSAGE_STORAGE=log keeps messages in memory-mapped log, which is used by one process, so not behind broker
+// CP_PULL_END_POINT, CP_ROUTER_END_POINT and CP_PUBLISH_END_POINT environment variables replace bind end points;
+// behind broker CP_BROKER_PUBLISH_END_POINT is XSUB end point of its client bus, CP_BROKER_INTERNAL_PUBLISH_END_POINT
+// and CP_BROKER_INTERNAL_SUBSCRIBE_END_POINT are XSUB and XPUB end points of its internal bus,
+// then every server process is started in same directory, so they share database files
+auto main(int argc, char *argv[]) -> int {
     try {
-        Server::get().configurePullSocketEndPoint("tcp://" + getIP() + ":4506");
+        if (const auto *logLevel = std::getenv("CP_LOG_LEVEL")) {
+            Logger::get().setLevel(parseLogLevel(logLevel));
+        }
+        const std::string address = (argc > 4) ? argv[4] : getIP();
+        if (argc > 1) {
+            Server::get().configureWorkers(std::stoul(argv[1]));
+        }
+        if (argc > 3) {
+            Server::get().configureGroupCommit(std::stoul(argv[2]), std::chrono::microseconds(std::stol(argv[3])));
+        }
+        Server::get().configurePullSocketEndPoint(getEndPoint("CP_PULL_END_POINT", "tcp://" + address + ":4506"));
+        Server::get().configureRouterSocketEndPoint(getEndPoint("CP_ROUTER_END_POINT", "tcp://" + address + ":4507"));
+
+        const auto brokerPublishEndPoint = getEndPoint("CP_BROKER_PUBLISH_END_POINT", "");
+        const auto brokerInternalPublishEndPoint = getEndPoint("CP_BROKER_INTERNAL_PUBLISH_END_POINT", "");
+        const auto brokerInternalSubscribeEndPoint = getEndPoint("CP_BROKER_INTERNAL_SUBSCRIBE_END_POINT", "");
+        if (!brokerPublishEndPoint.empty() && !brokerInternalPublishEndPoint.empty() &&
+            !brokerInternalSubscribeEndPoint.empty()) {
+            Server::get().configureBroker(brokerPublishEndPoint, brokerInternalPublishEndPoint,
+                                          brokerInternalSubscribeEndPoint);
+        } else {
+            Server::get().configurePublishSocketEndPoint(
+                    getEndPoint("CP_PUBLISH_END_POINT", "tcp://" + address + ":4508"));
+        }
         Server::get().run();
-    } catch (std::runtime_error &err) {
-        std::cout << err.what() << std::endl;
+    } catch (std::exception &err) {
+        logError(err.what());
         exit(1);
     }
     return 0;